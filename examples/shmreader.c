@@ -0,0 +1,121 @@
+// Prints the records Levels publishes with its publish argument, as they
+// come in. Not built with the plugin:
+//
+//     cc -std=gnu99 -Isrc -o shmreader examples/shmreader.c -lrt
+//     ./shmreader /levels [count]
+//
+// where /levels is what was passed as publish. It stops after count
+// records, if given.
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "publish.h"
+
+
+// head goes up before the record is written, so the slot may still hold
+// an older record, or be in the middle of being written, for a little
+// while. Returns 0 if the record doesn't show up (its writer dropped it)
+// or has already been overwritten by a newer one.
+static int readRecord(const HistShmSlot *slot, uint64_t index, HistShmRecord *record) {
+    for (int tries = 0; tries < 1000; tries++) {
+        if (histShmRead(slot, record)) {
+            if (record->index == index)
+                return 1;
+            if (record->index > index)
+                return 0;
+        }
+
+        sched_yield();
+    }
+
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s name [count]\n", argv[0]);
+        return 1;
+    }
+
+    const long count = argc > 2 ? atol(argv[2]) : -1;
+
+    int fd = shm_open(argv[1], O_RDONLY, 0);
+    if (fd < 0) {
+        perror("shm_open");
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(HistShmHeader)) {
+        fprintf(stderr, "%s is not a histogram ring\n", argv[1]);
+        return 1;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    const HistShmHeader *header = (const HistShmHeader *)data;
+    const HistShmSlot *slots = (const HistShmSlot *)((const uint8_t *)data + sizeof(HistShmHeader));
+
+    if (memcmp(header->magic, HIST_SHM_MAGIC, sizeof(header->magic)) || header->version != HIST_SHM_VERSION ||
+        header->slot_size != sizeof(HistShmSlot) || sizeof(HistShmHeader) + (size_t)header->num_slots * sizeof(HistShmSlot) > (size_t)st.st_size) {
+        fprintf(stderr, "%s is not a histogram ring this reader understands\n", argv[1]);
+        return 1;
+    }
+
+    printf("%" PRIu32 "x%" PRIu32 ", %" PRIu32 " planes, %" PRIu32 " slots\n", header->width, header->height, header->num_planes, header->num_slots);
+
+    // Only what gets published from now on.
+    uint64_t next = atomic_load_explicit(&((HistShmHeader *)header)->head, memory_order_acquire);
+    long printed = 0;
+
+    while (count < 0 || printed < count) {
+        const uint64_t head = atomic_load_explicit(&((HistShmHeader *)header)->head, memory_order_acquire);
+
+        if (head == next) {
+            const struct timespec ts = { 0, 10 * 1000 * 1000 };
+            nanosleep(&ts, NULL);
+            continue;
+        }
+
+        // Whatever is more than a lap behind is gone.
+        if (head - next > header->num_slots) {
+            printf("missed %" PRIu64 " records\n", head - next - header->num_slots);
+            next = head - header->num_slots;
+        }
+
+        for (; next < head && (count < 0 || printed < count); next++) {
+            HistShmRecord record;
+
+            if (!readRecord(&slots[next % header->num_slots], next, &record)) {
+                printf("record %" PRIu64 " was dropped or overwritten\n", next);
+                continue;
+            }
+
+            printf("frame %" PRId32 ":", record.frame);
+            for (uint32_t plane = 0; plane < record.num_planes && plane < 3; plane++)
+                printf(" [min %" PRIu32 " max %" PRIu32 " mean %.2f]", record.min[plane], record.max[plane], record.mean[plane]);
+            printf("\n");
+
+            printed++;
+        }
+    }
+
+    munmap(data, st.st_size);
+
+    return 0;
+}
@@ -0,0 +1,214 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <VapourSynth4.h>
+#include "VSHelper4.h"
+
+#include "common.h"
+#include "count.h"
+
+typedef struct AnalyzeData AnalyzeData;
+
+// Every request in flight has a slot, and a slot never has more than one
+// request in flight, so its accumulator needs no locking.
+typedef struct {
+    AnalyzeData *d;
+    int64_t hist[3][256];
+} AnalyzeSlot;
+
+struct AnalyzeData {
+    VSNode *node;
+    const VSAPI *vsapi;
+    int num_planes;
+    int last;
+
+    atomic_int next;
+    atomic_int failed;
+
+    int num_slots;
+    AnalyzeSlot *slots;
+
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int in_flight;
+    char error[512];
+};
+
+
+static void VS_CC analyzeFrameDone(void *userData, const VSFrame *f, int n, VSNode *node, const char *errorMsg) {
+    AnalyzeSlot *slot = (AnalyzeSlot *)userData;
+    AnalyzeData *d = slot->d;
+    const VSAPI *vsapi = d->vsapi;
+
+    if (f) {
+        for (int plane = 0; plane < d->num_planes; plane++) {
+            int hist[256] = { 0 };
+
+            countPlane(hist, vsapi->getReadPtr(f, plane), vsapi->getStride(f, plane), vsapi->getFrameWidth(f, plane), vsapi->getFrameHeight(f, plane), NULL, 0, 0, 0, NULL);
+
+            for (int i = 0; i < 256; i++)
+                slot->hist[plane][i] += hist[i];
+        }
+
+        vsapi->freeFrame(f);
+    }
+    else if (!atomic_exchange(&d->failed, 1)) {
+        snprintf(d->error, sizeof(d->error), "Analyze: failed to get frame %d: %s", n, errorMsg ? errorMsg : "unknown error");
+    }
+
+    int next = atomic_fetch_add(&d->next, 1);
+
+    if (next <= d->last && !atomic_load(&d->failed)) {
+        vsapi->getFrameAsync(next, d->node, analyzeFrameDone, slot);
+    }
+    else {
+        pthread_mutex_lock(&d->lock);
+        if (!--d->in_flight)
+            pthread_cond_signal(&d->done);
+        pthread_mutex_unlock(&d->lock);
+    }
+}
+
+
+static int writeReport(const char *path, const int64_t hist[3][256], int num_planes) {
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return 0;
+
+    fprintf(f, "bin");
+    for (int plane = 0; plane < num_planes; plane++)
+        fprintf(f, ",plane%d", plane);
+    fputc('\n', f);
+
+    for (int i = 0; i < 256; i++) {
+        fprintf(f, "%d", i);
+        for (int plane = 0; plane < num_planes; plane++)
+            fprintf(f, ",%lld", (long long)hist[plane][i]);
+        fputc('\n', f);
+    }
+
+    int ok = !ferror(f);
+    return fclose(f) == 0 && ok;
+}
+
+
+void VS_CC analyzeCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
+    AnalyzeData d;
+    int err;
+
+    d.node = vsapi->mapGetNode(in, "clip", 0, 0);
+    const VSVideoInfo *vi = vsapi->getVideoInfo(d.node);
+
+    if (!vsh_isConstantVideoFormat(vi) || vi->format.sampleType != stInteger || vi->format.bitsPerSample != 8) {
+        vsapi->mapSetError(out, "Analyze: only constant format 8bit integer input supported");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    int first = vsapi->mapGetIntSaturated(in, "first", 0, &err);
+    if (err)
+        first = 0;
+
+    d.last = vsapi->mapGetIntSaturated(in, "last", 0, &err);
+    if (err)
+        d.last = vi->numFrames - 1;
+
+    if (first < 0 || d.last >= vi->numFrames || first > d.last) {
+        vsapi->mapSetError(out, "Analyze: first and last must be valid frame numbers and first must not be greater than last");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    VSCoreInfo info;
+    vsapi->getCoreInfo(core, &info);
+
+    d.num_slots = vsapi->mapGetIntSaturated(in, "window", 0, &err);
+    if (err)
+        d.num_slots = info.numThreads;
+
+    if (d.num_slots < 1) {
+        vsapi->mapSetError(out, "Analyze: window must be at least 1");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    d.num_slots = MIN(d.num_slots, d.last - first + 1);
+
+    d.vsapi = vsapi;
+    d.num_planes = vi->format.numPlanes;
+    d.slots = (AnalyzeSlot *)calloc(d.num_slots, sizeof(AnalyzeSlot));
+    d.in_flight = d.num_slots;
+    d.error[0] = 0;
+    atomic_init(&d.next, first + d.num_slots);
+    atomic_init(&d.failed, 0);
+    pthread_mutex_init(&d.lock, NULL);
+    pthread_cond_init(&d.done, NULL);
+
+    for (int i = 0; i < d.num_slots; i++) {
+        d.slots[i].d = &d;
+        vsapi->getFrameAsync(first + i, d.node, analyzeFrameDone, &d.slots[i]);
+    }
+
+    pthread_mutex_lock(&d.lock);
+    while (d.in_flight)
+        pthread_cond_wait(&d.done, &d.lock);
+    pthread_mutex_unlock(&d.lock);
+
+    pthread_cond_destroy(&d.done);
+    pthread_mutex_destroy(&d.lock);
+    vsapi->freeNode(d.node);
+
+    if (atomic_load(&d.failed)) {
+        vsapi->mapSetError(out, d.error);
+        free(d.slots);
+        return;
+    }
+
+    // Merge the slots.
+    int64_t hist[3][256] = { { 0 } };
+
+    for (int i = 0; i < d.num_slots; i++)
+        for (int plane = 0; plane < d.num_planes; plane++)
+            for (int j = 0; j < 256; j++)
+                hist[plane][j] += d.slots[i].hist[plane][j];
+
+    free(d.slots);
+
+    const char *path = vsapi->mapGetData(in, "file", 0, &err);
+    if (!err && !writeReport(path, hist, d.num_planes)) {
+        char error[300];
+        snprintf(error, sizeof(error), "Analyze: failed to write '%s'", path);
+        vsapi->mapSetError(out, error);
+        return;
+    }
+
+    vsapi->mapSetInt(out, "frames", d.last - first + 1, maReplace);
+
+    for (int plane = 0; plane < d.num_planes; plane++) {
+        char key[8];
+        snprintf(key, sizeof(key), "hist%d", plane);
+        vsapi->mapSetIntArray(out, key, hist[plane], 256);
+
+        int64_t total = 0;
+        double sum = 0.0;
+        int min = -1;
+        int max = -1;
+
+        for (int i = 0; i < 256; i++) {
+            if (!hist[plane][i])
+                continue;
+
+            if (min < 0)
+                min = i;
+            max = i;
+            total += hist[plane][i];
+            sum += (double)i * hist[plane][i];
+        }
+
+        vsapi->mapSetInt(out, "min", min, maAppend);
+        vsapi->mapSetInt(out, "max", max, maAppend);
+        vsapi->mapSetFloat(out, "mean", total ? sum / total : 0.0, maAppend);
+    }
+}
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include <VapourSynth4.h>
+#include "VSHelper4.h"
+
+#include "bench.h"
+#include "common.h"
+#include "count.h"
+
+typedef struct {
+    VSNode *node;
+    VSVideoInfo vi;
+    int iterations;
+
+    int num_kernels;
+    BenchKernel kernels[BENCH_MAX_KERNELS];
+    void *data;
+
+    RGBTables *rgb; // Only for RGB clips.
+} BenchData;
+
+
+// In milliseconds.
+static double now(void) {
+#ifdef _WIN32
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return count.QuadPart * 1000.0 / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#endif
+}
+
+
+// What the kernels that only draw start from, counted the way the filters count.
+static void countBenchFrame(BenchFrame *f, int *histUV) {
+    const VSVideoFormat *fi = f->fi;
+
+    for (int plane = 0; plane < fi->numPlanes; plane++) {
+        if (fi->sampleType == stInteger && fi->bitsPerSample == 8) {
+            countPlane(f->hist[plane], f->srcp[plane], f->src_stride[plane], f->width[plane], f->height[plane], NULL, 0, 0, 0, NULL);
+        }
+        else if (fi->sampleType == stFloat && fi->bitsPerSample == 32) {
+            FloatBins bins;
+            if (plane && fi->colorFamily == cfYUV)
+                floatBinsInit(&bins, TRANSFER_LINEAR, -0.5, 0.5, 100.0);
+            else
+                floatBinsInit(&bins, TRANSFER_LINEAR, 0.0, 1.0, 100.0);
+            countPlaneFloat(f->hist[plane], f->srcp[plane], f->src_stride[plane], f->width[plane], f->height[plane], NULL, 0, 0, 0, &bins);
+        }
+    }
+
+    if (!histUV)
+        return;
+
+    for (int y = 0; y < f->height[U]; y++) {
+        for (int x = 0; x < f->width[U]; x++) {
+            int u, v;
+
+            if (f->rgb) {
+                int luma;
+                rgbToYUV(f->rgb, f->srcp[0][y * f->src_stride[0] + x], f->srcp[1][y * f->src_stride[1] + x], f->srcp[2][y * f->src_stride[2] + x], &luma, &u, &v);
+            }
+            else {
+                u = f->srcp[U][y * f->src_stride[U] + x];
+                v = f->srcp[V][y * f->src_stride[V] + x];
+            }
+
+            histUV[v * 256 + u]++;
+        }
+    }
+}
+
+
+static const VSFrame *VS_CC benchGetFrame(int n, int activationReason, void *instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    BenchData *d = (BenchData *) instanceData;
+
+    if (activationReason == arInitial) {
+        vsapi->requestFrameFilter(n, d->node, frameCtx);
+    }
+    else if (activationReason == arAllFramesReady) {
+        const VSFrame *src = vsapi->getFrameFilter(n, d->node, frameCtx);
+        const VSVideoFormat *fi = &d->vi.format;
+
+        BenchFrame f;
+        memset(&f, 0, sizeof(f));
+        f.fi = fi;
+        f.rgb = d->rgb;
+
+        // Room for Classic's RGB parade, the widest panel, and for the
+        // 512 px tall panels.
+        const int dst_width = vsapi->getFrameWidth(src, 0) + 3 * 256;
+        const int dst_height = MAX(512, vsapi->getFrameHeight(src, 0));
+
+        for (int plane = 0; plane < fi->numPlanes; plane++) {
+            const int subW = (plane && fi->colorFamily == cfYUV) ? fi->subSamplingW : 0;
+            const int subH = (plane && fi->colorFamily == cfYUV) ? fi->subSamplingH : 0;
+
+            f.srcp[plane] = vsapi->getReadPtr(src, plane);
+            f.src_stride[plane] = vsapi->getStride(src, plane);
+            f.width[plane] = vsapi->getFrameWidth(src, plane);
+            f.height[plane] = vsapi->getFrameHeight(src, plane);
+
+            f.dst_stride[plane] = (((dst_width >> subW) * fi->bytesPerSample) + 63) & ~63;
+            f.dst_height[plane] = dst_height >> subH;
+            f.dstp[plane] = (uint8_t *)calloc(f.dst_stride[plane], f.dst_height[plane]);
+
+            for (int y = 0; y < f.height[plane]; y++)
+                memcpy(f.dstp[plane] + y * f.dst_stride[plane], f.srcp[plane] + y * f.src_stride[plane], f.width[plane] * fi->bytesPerSample);
+        }
+
+        uint8_t *mask = (uint8_t *)malloc(f.width[0] * f.height[0]);
+        memset(mask, 255, f.width[0] * f.height[0]);
+        f.maskp = mask;
+        f.mask_stride = f.width[0];
+
+        int *histUV = NULL;
+        if (fi->colorFamily != cfGray && fi->sampleType == stInteger && fi->bitsPerSample == 8)
+            histUV = (int *)calloc(256 * 256, sizeof(int));
+        f.histUV = histUV;
+
+        countBenchFrame(&f, histUV);
+
+        VSFrame *dst = vsapi->copyFrame(src, core);
+        VSMap *props = vsapi->getFramePropertiesRW(dst);
+
+        vsapi->mapSetInt(props, "bench_iterations", d->iterations, maReplace);
+
+        for (int k = 0; k < d->num_kernels; k++) {
+            const BenchKernel *kernel = &d->kernels[k];
+            double total = 0.0;
+            double fastest = 0.0;
+
+            // Once first, so the caches look the same for every iteration.
+            kernel->run(&f, d->data);
+
+            for (int i = 0; i < d->iterations; i++) {
+                double start = now();
+                kernel->run(&f, d->data);
+                double elapsed = now() - start;
+
+                total += elapsed;
+                if (!i || elapsed < fastest)
+                    fastest = elapsed;
+            }
+
+            char key[64];
+
+            vsapi->mapSetData(props, "bench_kernels", kernel->name, -1, dtUtf8, maAppend);
+
+            snprintf(key, sizeof(key), "bench_%s", kernel->name);
+            vsapi->mapSetFloat(props, key, total / d->iterations, maReplace);
+
+            snprintf(key, sizeof(key), "bench_%s_min", kernel->name);
+            vsapi->mapSetFloat(props, key, fastest, maReplace);
+        }
+
+        for (int plane = 0; plane < fi->numPlanes; plane++)
+            free(f.dstp[plane]);
+        free(mask);
+        free(histUV);
+
+        vsapi->freeFrame(src);
+
+        return dst;
+    }
+
+    return 0;
+}
+
+
+static void VS_CC benchFree(void *instanceData, VSCore *core, const VSAPI *vsapi) {
+    BenchData *d = (BenchData *)instanceData;
+    vsapi->freeNode(d->node);
+    free(d->data);
+    free(d->rgb);
+    free(d);
+}
+
+
+void VS_CC benchCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
+    BenchData d;
+    BenchData *data;
+    int err;
+
+    static const struct {
+        const char *name;
+        BenchKernelsFunc kernels;
+    } modes[] = {
+        { "classic", classicBenchKernels },
+        { "levels", levelsBenchKernels },
+        { "color", colorBenchKernels },
+        { "color2", color2BenchKernels },
+        { "luma", lumaBenchKernels },
+        { "diff", diffBenchKernels }
+    };
+
+    d.node = vsapi->mapGetNode(in, "clip", 0, 0);
+    d.vi = *vsapi->getVideoInfo(d.node);
+
+    const char *mode = vsapi->mapGetData(in, "mode", 0, 0);
+    BenchKernelsFunc kernels = NULL;
+
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+        if (!strcmp(mode, modes[i].name))
+            kernels = modes[i].kernels;
+
+    if (!kernels) {
+        vsapi->mapSetError(out, "Bench: mode must be classic, levels, color, color2, luma or diff");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    d.iterations = vsapi->mapGetIntSaturated(in, "iterations", 0, &err);
+    if (err)
+        d.iterations = 10;
+
+    if (d.iterations < 1) {
+        vsapi->mapSetError(out, "Bench: iterations must be at least 1");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    d.data = NULL;
+    d.num_kernels = vsh_isConstantVideoFormat(&d.vi) ? kernels(&d.vi.format, d.kernels, &d.data) : 0;
+
+    if (!d.num_kernels) {
+        vsapi->mapSetError(out, "Bench: the clip's format is not supported by this mode");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    d.rgb = NULL;
+    if (d.vi.format.colorFamily == cfRGB) {
+        d.rgb = (RGBTables *)malloc(sizeof(RGBTables));
+        rgbTablesInit(d.rgb, 0.299, 0.114);
+    }
+
+    data = (BenchData *)malloc(sizeof(d));
+    *data = d;
+
+    // One frame at a time, so the timings don't include waiting for other threads.
+    VSFilterDependency deps[] = { {d.node, rpStrictSpatial} };
+    vsapi->createVideoFilter(out, "Bench", &d.vi, benchGetFrame, benchFree, fmUnordered, deps, 1, data, core);
+}
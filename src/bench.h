@@ -0,0 +1,49 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <VapourSynth4.h>
+
+#include "rgb.h"
+
+// One frame, the way hist.Bench hands it to the kernels. dstp is as big as
+// the biggest output any mode makes from the frame, and starts out as a copy
+// of it (Classic works in place). maskp lets every pixel through. hist and
+// histUV (NULL unless the clip is 8 bit YUV or RGB) are counted beforehand,
+// for the kernels that only draw.
+typedef struct {
+    const VSVideoFormat *fi;
+    const uint8_t *srcp[3];
+    int src_stride[3];
+    int width[3];
+    int height[3];
+    uint8_t *dstp[3];
+    int dst_stride[3];
+    int dst_height[3];
+    const uint8_t *maskp;
+    int mask_stride;
+    int hist[3][256];
+    const int *histUV;
+    const RGBTables *rgb; // Only for RGB clips.
+} BenchFrame;
+
+typedef struct {
+    const char *name;
+    void (*run)(const BenchFrame *f, const void *data);
+} BenchKernel;
+
+#define BENCH_MAX_KERNELS 8
+
+// Every mode lists the variants of its kernels that can handle fi and
+// returns how many there are, 0 if it doesn't support fi at all. *data,
+// if not NULL, is passed to every kernel and freed with free() afterwards.
+typedef int (*BenchKernelsFunc)(const VSVideoFormat *fi, BenchKernel kernels[BENCH_MAX_KERNELS], void **data);
+
+int classicBenchKernels(const VSVideoFormat *fi, BenchKernel kernels[BENCH_MAX_KERNELS], void **data);
+int levelsBenchKernels(const VSVideoFormat *fi, BenchKernel kernels[BENCH_MAX_KERNELS], void **data);
+int colorBenchKernels(const VSVideoFormat *fi, BenchKernel kernels[BENCH_MAX_KERNELS], void **data);
+int color2BenchKernels(const VSVideoFormat *fi, BenchKernel kernels[BENCH_MAX_KERNELS], void **data);
+int lumaBenchKernels(const VSVideoFormat *fi, BenchKernel kernels[BENCH_MAX_KERNELS], void **data);
+int diffBenchKernels(const VSVideoFormat *fi, BenchKernel kernels[BENCH_MAX_KERNELS], void **data);
+
+#endif
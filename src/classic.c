@@ -4,17 +4,185 @@
 #include <VapourSynth4.h>
 #include "VSHelper4.h"
 
+#include "bench.h"
 #include "common.h"
+#include "illegal.h"
+
+typedef void (*ClassicLumaFunc)(uint8_t *dstp, int dst_stride, int width, int height, const uint8_t exptab[256], int E167, int top_first, int *illegal);
+
+typedef void (*ClassicRGBFunc)(uint8_t *dstp[3], const int dst_stride[3], int width, int height, const uint8_t exptab[256]);
 
 typedef struct {
     VSNode *node;
     VSVideoInfo vi;
+    int fields;
+    int illegal;
+    int panel_width;
 
     int E167;
     uint8_t exptab[256];
+    uint8_t exptab_rgb[256]; // The same, in full range.
+
+    // Chosen in classicCreate.
+    ClassicLumaFunc luma;
+    ClassicRGBFunc rgb;
+    IllegalChromaFunc illegal_chroma;
+    // Every row of the U and V panels is the same.
+    uint8_t chroma_row[2][512 * sizeof(uint16_t)];
+    int chroma_row_size;
 } ClassicData;
 
 
+// The luma has already been copied to dstp. The plain version counts every
+// row and draws its histogram to the right of it. The Fields version counts
+// the two lines of each pair of rows separately and draws the first
+// field's histogram next to the second field's, on both lines.
+//
+// The RGB version draws a parade: the histograms of the row's R, G and B
+// next to each other, each in its own colour.
+//
+// If illegal is not NULL, the luma outside 16-235 is painted red while it's
+// counted, and *illegal is increased by how many such pixels there were.
+//
+// One version per bit depth, so the shifts are constants. Values that
+// round up past 255 go in the last bin.
+#define CLASSIC_LUMA(name, pixel_t, BITS) \
+static void name##Count(int hist[256], const pixel_t *row, int width) { \
+    for (int x = 0; x < width; x++) { \
+        hist[MIN(255, (row[x] + ((1 << ((BITS) - 8)) >> 1)) >> ((BITS) - 8))] += 1; \
+    } \
+} \
+\
+static int name##CountIllegal(int hist[256], pixel_t *row, int width) { \
+    int illegal = 0; \
+    for (int x = 0; x < width; x++) { \
+        hist[MIN(255, (row[x] + ((1 << ((BITS) - 8)) >> 1)) >> ((BITS) - 8))] += 1; \
+        if (row[x] < (16 << ((BITS) - 8)) || row[x] > (235 << ((BITS) - 8))) { \
+            row[x] = ILLEGAL_RED_Y << ((BITS) - 8); \
+            illegal++; \
+        } \
+    } \
+    return illegal; \
+} \
+\
+static void name##Draw(pixel_t *panel, const int hist[256], const uint8_t exptab[256], int E167) { \
+    for (int x = 0; x < 256; x++) { \
+        int value; \
+        if (x < 16 || x == 124 || x > 235) { \
+            value = exptab[MIN(E167, hist[x])] + 68; /* Magic numbers! */ \
+        } \
+        else { \
+            value = exptab[MIN(255, hist[x])]; \
+        } \
+        panel[x] = value << ((BITS) - 8); \
+    } \
+} \
+\
+static void name(uint8_t *dstp, int dst_stride, int width, int height, const uint8_t exptab[256], int E167, int top_first, int *illegal) { \
+    for (int y = 0; y < height; y++) { \
+        pixel_t *row = (pixel_t *)(dstp + y * dst_stride); \
+        int hist[256] = { 0 }; \
+        \
+        if (illegal) \
+            *illegal += name##CountIllegal(hist, row, width); \
+        else \
+            name##Count(hist, row, width); \
+        name##Draw(row + width, hist, exptab, E167); \
+    } \
+} \
+\
+static void name##Fields(uint8_t *dstp, int dst_stride, int width, int height, const uint8_t exptab[256], int E167, int top_first, int *illegal) { \
+    for (int y = 0; y < height; y += 2) { \
+        pixel_t *top = (pixel_t *)(dstp + y * dst_stride); \
+        pixel_t *bottom = (y + 1 < height) ? (pixel_t *)(dstp + (y + 1) * dst_stride) : NULL; \
+        int hist[2][256] = { { 0 } }; \
+        \
+        if (illegal) { \
+            *illegal += name##CountIllegal(hist[0], top, width); \
+            if (bottom) \
+                *illegal += name##CountIllegal(hist[1], bottom, width); \
+        } \
+        else { \
+            name##Count(hist[0], top, width); \
+            if (bottom) \
+                name##Count(hist[1], bottom, width); \
+        } \
+        \
+        name##Draw(top + width, hist[!top_first], exptab, E167); \
+        name##Draw(top + width + 256, hist[!!top_first], exptab, E167); \
+        if (bottom) \
+            memcpy(bottom + width, top + width, 512 * sizeof(pixel_t)); \
+    } \
+} \
+\
+static void name##RGB(uint8_t *dstp[3], const int dst_stride[3], int width, int height, const uint8_t exptab[256]) { \
+    for (int y = 0; y < height; y++) { \
+        for (int p = 0; p < 3; p++) { \
+            int hist[256] = { 0 }; \
+            \
+            name##Count(hist, (const pixel_t *)(dstp[p] + y * dst_stride[p]), width); \
+            \
+            for (int q = 0; q < 3; q++) { \
+                pixel_t *panel = (pixel_t *)(dstp[q] + y * dst_stride[q]) + width + p * 256; \
+                \
+                if (q != p) { \
+                    memset(panel, 0, 256 * sizeof(pixel_t)); \
+                    continue; \
+                } \
+                for (int x = 0; x < 256; x++) \
+                    panel[x] = exptab[MIN(255, hist[x])] << ((BITS) - 8); \
+            } \
+        } \
+    } \
+}
+
+CLASSIC_LUMA(classicLuma8, uint8_t, 8)
+CLASSIC_LUMA(classicLuma9, uint16_t, 9)
+CLASSIC_LUMA(classicLuma10, uint16_t, 10)
+CLASSIC_LUMA(classicLuma11, uint16_t, 11)
+CLASSIC_LUMA(classicLuma12, uint16_t, 12)
+CLASSIC_LUMA(classicLuma13, uint16_t, 13)
+CLASSIC_LUMA(classicLuma14, uint16_t, 14)
+CLASSIC_LUMA(classicLuma15, uint16_t, 15)
+CLASSIC_LUMA(classicLuma16, uint16_t, 16)
+
+
+static const ClassicLumaFunc luma_funcs[2][9] = {
+    {
+        classicLuma8, classicLuma9, classicLuma10, classicLuma11, classicLuma12,
+        classicLuma13, classicLuma14, classicLuma15, classicLuma16
+    },
+    {
+        classicLuma8Fields, classicLuma9Fields, classicLuma10Fields, classicLuma11Fields, classicLuma12Fields,
+        classicLuma13Fields, classicLuma14Fields, classicLuma15Fields, classicLuma16Fields
+    }
+};
+
+static const ClassicRGBFunc rgb_funcs[9] = {
+    classicLuma8RGB, classicLuma9RGB, classicLuma10RGB, classicLuma11RGB, classicLuma12RGB,
+    classicLuma13RGB, classicLuma14RGB, classicLuma15RGB, classicLuma16RGB
+};
+
+
+// exptab maps a count to a brightness, E167 is the highest count that
+// still leaves room for the +68 of the unsafe zones.
+static void makeExpTab(uint8_t exptab[256], uint8_t exptab_rgb[256], int *E167) {
+    const double K = log(0.5 / 219) / 255;
+
+    exptab[0] = 16;
+    int i;
+    for (i = 1; i < 255; i++) {
+        exptab[i] = (uint8_t)(16.5 + 219 * (1 - exp(i * K)));
+        if (exptab[i] <= 235 - 68)
+            *E167 = i;
+    }
+    exptab[255] = 235;
+
+    for (i = 0; i < 256; i++)
+        exptab_rgb[i] = (uint8_t)((exptab[i] - 16) * 255 / 219);
+}
+
+
 static const VSFrame *VS_CC classicGetFrame(int n, int activationReason, void *instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
     ClassicData *d = (ClassicData *) instanceData;
 
@@ -26,10 +194,16 @@ static const VSFrame *VS_CC classicGetFrame(int n, int activationReason, void *i
 
         const VSVideoFormat *fi = &d->vi.format;
         int height = vsapi->getFrameHeight(src, 0);
-        int width = vsapi->getFrameWidth(src, 0) + 256;
+        int width = vsapi->getFrameWidth(src, 0) + d->panel_width;
 
         VSFrame *dst = vsapi->newVideoFrame(fi, width, height, src, core);
 
+        const uint8_t *srcps[3];
+        int src_strides[3];
+        uint8_t *dstps[3];
+        int dst_strides[3];
+        int illegal_luma = 0;
+
         int plane;
         for (plane = 0; plane < fi->numPlanes; plane++) {
             const uint8_t *srcp = vsapi->getReadPtr(src, plane);
@@ -39,100 +213,45 @@ static const VSFrame *VS_CC classicGetFrame(int n, int activationReason, void *i
             int h = vsapi->getFrameHeight(src, plane);
             int y;
             int w = vsapi->getFrameWidth(src, plane);
-            int x;
 
-            // Copy src to dst one line at a time.
-            for (y = 0; y < h; y++) {
-                memcpy(dstp + dst_stride * y, srcp + src_stride * y, src_stride);
+            // Copy src to dst one line at a time. The overlay copies the
+            // chroma itself, see below.
+            if (!d->illegal || plane == 0) {
+                for (y = 0; y < h; y++) {
+                    memcpy(dstp + dst_stride * y, srcp + src_stride * y, src_stride);
+                }
             }
 
-            int bps = fi->bitsPerSample;
-            if (bps == 8) {
-                // Now draw the histogram in the right side of dst.
-                if (plane == 0) {
-                    for (y = 0; y < h; y++) {
-                        int hist[256] = { 0 };
-                        for (x = 0; x < w; x++) {
-                            hist[dstp[x]] += 1;
-                        }
-                        for (x = 0; x < 256; x++) {
-                            if (x < 16 || x == 124 || x > 235) {
-                                dstp[x + w] = d->exptab[MIN(d->E167, hist[x])] + 68; // Magic numbers!
-                            }
-                            else {
-                                dstp[x + w] = d->exptab[MIN(255, hist[x])];
-                            }
-                        }
-                        dstp += dst_stride;
-                    }
-                }
-                else {
-                    const int subs = fi->subSamplingW;
-                    const int factor = 1 << subs;
-
-                    for (y = 0; y < h; y++) {
-                        for (x = 0; x < 256; x += factor) {
-                            if (x < 16 || x > 235) {
-                                // Blue. Because I can.
-                                dstp[(x >> subs) + w] = (plane == 1) ? 200 : 128;
-                            }
-                            else if (x == 124) {
-                                dstp[(x >> subs) + w] = (plane == 1) ? 160 : 16;
-                            }
-                            else {
-                                dstp[(x >> subs) + w] = 128;
-                            }
-                        }
-                        dstp += dst_stride;
-                    }
-                }
+            srcps[plane] = srcp;
+            src_strides[plane] = src_stride;
+            dstps[plane] = dstp;
+            dst_strides[plane] = dst_stride;
+
+            // Now draw the histogram in the right side of dst.
+            if (d->rgb) {
+                // All three planes are needed, see below.
+            }
+            else if (plane == 0) {
+                d->luma(dstp, dst_stride, w, h, d->exptab, d->E167, d->fields && isTopFieldFirst(src, vsapi), d->illegal ? &illegal_luma : NULL);
             }
             else {
-                uint16_t* dstp16 = (uint16_t*)dstp;
-                // Now draw the histogram in the right side of dst.
-                if (plane == 0) {
-                    for (y = 0; y < h; y++) {
-                        int hist[256] = { 0 };
-                        for (x = 0; x < w; x++) {
-                            // Add (1 << (bps - 8 - 1)) for rounding.
-                            hist[(dstp16[x] + (1 << (bps - 8 - 1))) >> (bps - 8)] += 1;
-                        }
-                        for (x = 0; x < 256; x++) {
-                            if (x < 16 || x == 124 || x > 235) {
-                                dstp16[x + w] = d->exptab[MIN(d->E167, hist[x])] + 68; // Magic numbers!
-                            }
-                            else {
-                                dstp16[x + w] = d->exptab[MIN(255, hist[x])];
-                            }
-                            dstp16[x + w] <<= (bps - 8);
-                        }
-                        dstp16 += dst_stride / 2;
-                    }
+                for (y = 0; y < h; y++) {
+                    memcpy(dstp + y * dst_stride + w * fi->bytesPerSample, d->chroma_row[plane - 1], d->chroma_row_size);
                 }
-                else {
-                    const int subs = fi->subSamplingW;
-                    const int factor = 1 << subs;
-
-                    for (y = 0; y < h; y++) {
-                        for (x = 0; x < 256; x += factor) {
-                            if (x < 16 || x > 235) {
-                                // Blue. Because I can.
-                                dstp16[(x >> subs) + w] = (plane == 1) ? 200 : 128;
-                            }
-                            else if (x == 124) {
-                                dstp16[(x >> subs) + w] = (plane == 1) ? 160 : 16;
-                            }
-                            else {
-                                dstp16[(x >> subs) + w] = 128;
-                            }
-                            dstp16[(x >> subs) + w] <<= (bps - 8);
-                        }
-                        dstp16 += dst_stride / 2;
-                    }
-                } // if plane
-            } // if bps
+            }
         } // for plane
 
+        if (d->rgb)
+            d->rgb(dstps, dst_strides, vsapi->getFrameWidth(src, 0), vsapi->getFrameHeight(src, 0), d->exptab_rgb);
+
+        if (d->illegal) {
+            VSMap *props = vsapi->getFramePropertiesRW(dst);
+            int illegal_chroma = d->illegal_chroma(NULL, NULL, srcps, src_strides, dstps, dst_strides, vsapi->getFrameWidth(src, 1), vsapi->getFrameHeight(src, 1), NULL, 0, fi->subSamplingW, fi->subSamplingH);
+
+            vsapi->mapSetInt(props, "illegal_luma", illegal_luma, maReplace);
+            vsapi->mapSetInt(props, "illegal_chroma", illegal_chroma, maReplace);
+        }
+
         vsapi->freeFrame(src);
 
         return dst;
@@ -152,36 +271,127 @@ static void VS_CC classicFree(void *instanceData, VSCore *core, const VSAPI *vsa
 void VS_CC classicCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
     ClassicData d;
     ClassicData *data;
+    int err;
 
-    const double K = log(0.5 / 219) / 255;
-
-    d.exptab[0] = 16;
-    int i;
-    for (i = 1; i < 255; i++) {
-        d.exptab[i] = (uint8_t)(16.5 + 219 * (1 - exp(i * K)));
-        if (d.exptab[i] <= 235 - 68)
-            d.E167 = i;
-    }
-    d.exptab[255] = 235;
+    makeExpTab(d.exptab, d.exptab_rgb, &d.E167);
 
     d.node = vsapi->mapGetNode(in, "clip", 0, 0);
     d.vi = *vsapi->getVideoInfo(d.node);
 
+    d.fields = !!vsapi->mapGetInt(in, "fields", 0, &err);
+    d.illegal = !!vsapi->mapGetInt(in, "illegal", 0, &err);
+
     if (!vsh_isConstantVideoFormat(&d.vi)
         || d.vi.format.sampleType != stInteger
         || d.vi.format.bitsPerSample > 16
-        || d.vi.format.colorFamily != cfYUV) {
-        vsapi->mapSetError(out, "Classic: only constant format 8 to 16 bit integer YUV input supported");
+        || d.vi.format.colorFamily == cfGray) {
+        vsapi->mapSetError(out, "Classic: only constant format 8 to 16 bit integer YUV or RGB input supported");
         vsapi->freeNode(d.node);
         return;
     }
 
+    if (d.fields && d.vi.format.colorFamily == cfRGB) {
+        vsapi->mapSetError(out, "Classic: fields is only supported for YUV input");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    if (d.illegal && d.vi.format.colorFamily == cfRGB) {
+        vsapi->mapSetError(out, "Classic: illegal is only supported for YUV input");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    d.luma = luma_funcs[d.fields][d.vi.format.bitsPerSample - 8];
+    d.rgb = (d.vi.format.colorFamily == cfRGB) ? rgb_funcs[d.vi.format.bitsPerSample - 8] : NULL;
+    d.panel_width = d.rgb ? 3 * 256 : d.fields ? 512 : 256;
+    d.illegal_chroma = d.illegal ? selectIllegalChroma(d.vi.format.bitsPerSample, d.vi.format.subSamplingW, d.vi.format.subSamplingH) : NULL;
+
+    const int bps = d.vi.format.bitsPerSample;
+    const int subs = d.vi.format.subSamplingW;
+    const int factor = 1 << subs;
+
+    d.chroma_row_size = (256 >> subs) * d.vi.format.bytesPerSample;
+
+    for (int plane = 1; plane < 3; plane++) {
+        for (int x = 0; x < 256; x += factor) {
+            uint16_t value;
+            if (x < 16 || x > 235) {
+                // Blue. Because I can.
+                value = (plane == 1) ? 200 : 128;
+            }
+            else if (x == 124) {
+                value = (plane == 1) ? 160 : 16;
+            }
+            else {
+                value = 128;
+            }
+            value <<= (bps - 8);
+
+            if (bps == 8)
+                d.chroma_row[plane - 1][x >> subs] = (uint8_t)value;
+            else
+                memcpy(d.chroma_row[plane - 1] + (x >> subs) * sizeof(value), &value, sizeof(value));
+        }
+
+        // Both fields get the same markings.
+        if (d.fields)
+            memcpy(d.chroma_row[plane - 1] + d.chroma_row_size, d.chroma_row[plane - 1], d.chroma_row_size);
+    }
+
+    if (d.fields)
+        d.chroma_row_size *= 2;
+
     if (d.vi.width)
-        d.vi.width += 256;
+        d.vi.width += d.panel_width;
         
     data = (ClassicData *)malloc(sizeof(d));
     *data = d;
 
     VSFilterDependency deps[] = { {d.node, rpStrictSpatial} };
     vsapi->createVideoFilter(out, "Classic", &d.vi, classicGetFrame, classicFree, fmParallel, deps, 1, data, core);
-}
\ No newline at end of file
+}
+
+typedef struct {
+    uint8_t exptab[256];
+    uint8_t exptab_rgb[256];
+    int E167;
+} ClassicBenchData;
+
+
+static void benchLuma(const BenchFrame *f, const void *data) {
+    const ClassicBenchData *b = (const ClassicBenchData *)data;
+    luma_funcs[0][f->fi->bitsPerSample - 8](f->dstp[0], f->dst_stride[0], f->width[0], f->height[0], b->exptab, b->E167, 1, NULL);
+}
+
+
+static void benchLumaFields(const BenchFrame *f, const void *data) {
+    const ClassicBenchData *b = (const ClassicBenchData *)data;
+    luma_funcs[1][f->fi->bitsPerSample - 8](f->dstp[0], f->dst_stride[0], f->width[0], f->height[0], b->exptab, b->E167, 1, NULL);
+}
+
+
+static void benchParade(const BenchFrame *f, const void *data) {
+    const ClassicBenchData *b = (const ClassicBenchData *)data;
+    uint8_t *dstp[3] = { f->dstp[0], f->dstp[1], f->dstp[2] };
+    rgb_funcs[f->fi->bitsPerSample - 8](dstp, f->dst_stride, f->width[0], f->height[0], b->exptab_rgb);
+}
+
+
+int classicBenchKernels(const VSVideoFormat *fi, BenchKernel kernels[BENCH_MAX_KERNELS], void **data) {
+    if (fi->sampleType != stInteger || fi->bitsPerSample > 16 || fi->colorFamily == cfGray)
+        return 0;
+
+    ClassicBenchData *b = (ClassicBenchData *)malloc(sizeof(ClassicBenchData));
+    makeExpTab(b->exptab, b->exptab_rgb, &b->E167);
+    *data = b;
+
+    if (fi->colorFamily == cfRGB) {
+        kernels[0] = (BenchKernel){ "parade", benchParade };
+        return 1;
+    }
+
+    kernels[0] = (BenchKernel){ "luma", benchLuma };
+    kernels[1] = (BenchKernel){ "luma_fields", benchLumaFields };
+    return 2;
+}
@@ -3,26 +3,228 @@
 #include <VapourSynth4.h>
 #include "VSHelper4.h"
 
+#include "bench.h"
 #include "common.h"
+#include "export.h"
+#include "histindex.h"
+#include "panel.h"
+#include "rgb.h"
+
+typedef void (*CountUVFunc)(int histUV[256 * 256], uint8_t *lumaUV, int *lastUV, const uint8_t *srcpY, int src_strideY, const uint8_t *srcpU, const uint8_t *srcpV, int src_stride, int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH);
 
 typedef struct {
     VSNode *node;
+    VSNode *mask;
+    VSNode *compare;
     VSVideoInfo vi;
+    int size;
+    int diff;
+    HistExport *export;
+    HistIndex *index;
+    Panel panel;
+    RGBTables *rgb; // Only for RGB clips.
+    CountUVFunc count; // Chosen in colorCreate, only for YUV clips.
 } ColorData;
 
 
+// One counting loop per chroma subsampling, so the shifts are constants,
+// and the mask is only looked at when there is one. lumaUV and lastUV, if
+// not NULL, receive the luma and the raster position of the last pixel
+// with each chroma.
+#define COUNT_UV(name, SUBW, SUBH) \
+static void name(int histUV[256 * 256], uint8_t *lumaUV, int *lastUV, const uint8_t *srcpY, int src_strideY, const uint8_t *srcpU, const uint8_t *srcpV, int src_stride, int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH) { \
+    int x, y; \
+    \
+    for (y = 0; y < height; y++) { \
+        const uint8_t *rowY = srcpY + (y << (SUBH)) * src_strideY; \
+        const uint8_t *rowU = srcpU + y * src_stride; \
+        const uint8_t *rowV = srcpV + y * src_stride; \
+        \
+        if (maskp) { \
+            const uint8_t *maskrow = maskp + (y << (SUBH)) * mask_stride; \
+            \
+            for (x = 0; x < width; x++) { \
+                if (!maskrow[x << (SUBW)]) \
+                    continue; \
+                \
+                const int i = rowV[x] * 256 + rowU[x]; \
+                histUV[i]++; \
+                if (lumaUV) { \
+                    lumaUV[i] = rowY[x << (SUBW)]; \
+                    lastUV[i] = y * width + x; \
+                } \
+            } \
+        } \
+        else if (lumaUV) { \
+            for (x = 0; x < width; x++) { \
+                const int i = rowV[x] * 256 + rowU[x]; \
+                histUV[i]++; \
+                lumaUV[i] = rowY[x << (SUBW)]; \
+                lastUV[i] = y * width + x; \
+            } \
+        } \
+        else { \
+            for (x = 0; x < width; x++) \
+                histUV[rowV[x] * 256 + rowU[x]]++; \
+        } \
+    } \
+}
+
+COUNT_UV(countUVGeneric, subW, subH)
+COUNT_UV(countUV00, 0, 0)
+COUNT_UV(countUV01, 0, 1)
+COUNT_UV(countUV02, 0, 2)
+COUNT_UV(countUV10, 1, 0)
+COUNT_UV(countUV11, 1, 1)
+COUNT_UV(countUV12, 1, 2)
+COUNT_UV(countUV20, 2, 0)
+COUNT_UV(countUV21, 2, 1)
+COUNT_UV(countUV22, 2, 2)
+
+
+static CountUVFunc selectCountUV(int subW, int subH) {
+    static const CountUVFunc funcs[3][3] = {
+        { countUV00, countUV01, countUV02 },
+        { countUV10, countUV11, countUV12 },
+        { countUV20, countUV21, countUV22 }
+    };
+
+    if (subW <= 2 && subH <= 2)
+        return funcs[subW][subH];
+
+    return countUVGeneric;
+}
+
+
+// Like COUNT_UV, with the chroma (and luma) of each pixel taken from the tables.
+static void countRGB(int histUV[256 * 256], uint8_t *lumaUV, int *lastUV, const uint8_t *const srcp[3], const int src_stride[3], int width, int height, const uint8_t *maskp, int mask_stride, const RGBTables *t) {
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        const uint8_t *r = srcp[0] + y * src_stride[0];
+        const uint8_t *g = srcp[1] + y * src_stride[1];
+        const uint8_t *b = srcp[2] + y * src_stride[2];
+        const uint8_t *maskrow = maskp ? maskp + y * mask_stride : NULL;
+
+        for (x = 0; x < width; x++) {
+            if (maskrow && !maskrow[x])
+                continue;
+
+            int yval, uval, vval;
+            rgbToYUV(t, r[x], g[x], b[x], &yval, &uval, &vval);
+
+            const int i = vval * 256 + uval;
+            histUV[i]++;
+            if (lumaUV) {
+                lumaUV[i] = yval;
+                lastUV[i] = y * width + x;
+            }
+        }
+    }
+}
+
+
+// rgb is NULL for YUV clips, count is only used for them.
+static void countFrame(const VSVideoFormat *fi, const RGBTables *rgb, CountUVFunc count, int histUV[256 * 256], uint8_t *lumaUV, int *lastUV, const uint8_t *const srcp[3], const int src_stride[3], const int src_width[3], const int src_height[3], const uint8_t *maskp, int mask_stride) {
+    if (rgb)
+        countRGB(histUV, lumaUV, lastUV, srcp, src_stride, src_width[0], src_height[0], maskp, mask_stride, rgb);
+    else
+        count(histUV, lumaUV, lastUV, srcp[Y], src_stride[Y], srcp[U], srcp[V], src_stride[U], src_width[U], src_height[U], maskp, mask_stride, fi->subSamplingW, fi->subSamplingH);
+}
+
+
+// Draws the luma of the panel from the histogram, straight into the frame,
+// at the size of the template (zoom is the template's). At 128 px every
+// pixel shows the counts of 2x2 chroma values added up. histUV2, if not
+// NULL, is the comparison clip's. rgb is NULL for YUV clips.
+static void drawUV(uint8_t *dstp[3], const int dst_stride[3], const int *histUV, const int *histUV2, int diff, const RGBTables *rgb, int zoom) {
+    const int size = panelPos(zoom, 256);
+    const int step = panelStep(zoom);
+    int x, y;
+    int maxval = 1;
+
+    // Original comment: // Should we adjust the divisor (maxval)??
+
+    // Draw the luma.
+    for (y = 0; y < size; y++) {
+        // The first chroma value this row shows.
+        const int v = (y << 1) >> (zoom + 1);
+
+        for (x = 0; x < size; x++) {
+            const int u = (x << 1) >> (zoom + 1);
+            int a = 0;
+            int b = 0;
+
+            for (int i = 0; i < step; i++) {
+                for (int j = 0; j < step; j++) {
+                    a += histUV[(u + j) + (v + i) * 256];
+                    if (histUV2)
+                        b += histUV2[(u + j) + (v + i) * 256];
+                }
+            }
+
+            int disp_val = a / maxval;
+            if (histUV2) {
+                if (diff) {
+                    // Mid grey where both clips agree, brighter where the clip has more.
+                    // The difference is scaled against the larger count, so it
+                    // spans the whole range instead of clipping.
+                    int larger = MAX(a, b);
+                    disp_val = larger ? 110 + (int)((int64_t)(a - b) * 110 / larger) : 110;
+                }
+                else if (!disp_val && b) {
+                    // Mark where only the comparison clip has pixels.
+                    disp_val = 64;
+                }
+            }
+            if (v < 16 || v > 240 || u < 16 || u > 240) {
+                disp_val -= 16;
+            }
+            dstp[Y][y * dst_stride[Y] + x] = MAX(0, MIN(235, 16 + disp_val));
+        }
+    }
+
+    // For RGB clips the luma was drawn in the first plane, and each
+    // pixel is now converted along with its position's chroma.
+    if (rgb) {
+        for (y = 0; y < size; y++) {
+            for (x = 0; x < size; x++) {
+                yuvToRGB(rgb, dstp[0][y * dst_stride[0] + x], (x << 1) >> (zoom + 1), (y << 1) >> (zoom + 1),
+                         &dstp[0][y * dst_stride[0] + x],
+                         &dstp[1][y * dst_stride[1] + x],
+                         &dstp[2][y * dst_stride[2] + x]);
+            }
+        }
+    }
+}
+
+
+// Frames whose histograms come from the index don't need the mask, unless
+// the comparison clip is counted too.
+static int needsMask(const ColorData *d, int n) {
+    uint32_t size;
+    return d->mask && (d->compare || !d->index || !histIndexGet(d->index, n, &size));
+}
+
+
 static const VSFrame *VS_CC colorGetFrame(int n, int activationReason, void *instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
     ColorData *d = (ColorData *) instanceData;
 
     if (activationReason == arInitial) {
         vsapi->requestFrameFilter(n, d->node, frameCtx);
+        if (needsMask(d, n))
+            vsapi->requestFrameFilter(n, d->mask, frameCtx);
+        if (d->compare)
+            vsapi->requestFrameFilter(n, d->compare, frameCtx);
     }
     else if (activationReason == arAllFramesReady) {
         const VSFrame *src = vsapi->getFrameFilter(n, d->node, frameCtx);
+        const VSFrame *mask = needsMask(d, n) ? vsapi->getFrameFilter(n, d->mask, frameCtx) : NULL;
+        const VSFrame *cmp = d->compare ? vsapi->getFrameFilter(n, d->compare, frameCtx) : NULL;
 
         const VSVideoFormat *fi = &d->vi.format;
-        int height = MAX(256, vsapi->getFrameHeight(src, 0));
-        int width = vsapi->getFrameWidth(src, 0) + 256;
+        int height = MAX(d->size, vsapi->getFrameHeight(src, 0));
+        int width = vsapi->getFrameWidth(src, 0) + d->size;
 
         VSFrame *dst = vsapi->newVideoFrame(fi, width, height, src, core);
 
@@ -37,8 +239,9 @@ static const VSFrame *VS_CC colorGetFrame(int n, int activationReason, void *ins
 
         int dst_height[3];
 
+        uint8_t *panelp[3];
+
         int y;
-        int x;
 
         int plane;
 
@@ -54,6 +257,8 @@ static const VSFrame *VS_CC colorGetFrame(int n, int activationReason, void *ins
 
             dst_height[plane] = vsapi->getFrameHeight(dst, plane);
 
+            panelp[plane] = dstp[plane] + src_width[plane];
+
             // Copy src to dst one line at a time.
             for (y = 0; y < src_height[plane]; y++) {
                 memcpy(dstp[plane] + dst_stride[plane] * y,
@@ -61,10 +266,10 @@ static const VSFrame *VS_CC colorGetFrame(int n, int activationReason, void *ins
                     src_stride[plane]);
             }
 
-            // If src was less than 256 px tall, make the extra lines black.
+            // If src was less than the panel, make the extra lines black.
             if (src_height[plane] < dst_height[plane]) {
                 memset(dstp[plane] + src_height[plane] * dst_stride[plane],
-                    (plane == 0) ? 16 : 128,
+                    d->rgb ? 0 : (plane == 0) ? 16 : 128,
                     (dst_height[plane] - src_height[plane]) * dst_stride[plane]);
             }
         }
@@ -72,52 +277,66 @@ static const VSFrame *VS_CC colorGetFrame(int n, int activationReason, void *ins
         // Why not histUV[256][256] ?
         int histUV[256 * 256] = { 0 };
 
-        for (y = 0; y < src_height[U]; y++) {
-            for (x = 0; x < src_width[U]; x++) {
-                histUV[srcp[V][y * src_stride[V] + x] * 256 + srcp[U][y * src_stride[U] + x]]++;
+        // Only the first plane of the mask is used, sampled at the
+        // top left luma position of every chroma sample.
+        const uint8_t *maskp = mask ? vsapi->getReadPtr(mask, 0) : NULL;
+        const int mask_stride = mask ? vsapi->getStride(mask, 0) : 0;
+
+        uint32_t stored_size = 0;
+        const uint8_t *stored = d->index ? histIndexGet(d->index, n, &stored_size) : NULL;
+
+        if (stored) {
+            uint32_t num_cells;
+            memcpy(&num_cells, stored, sizeof(num_cells));
+
+            // The histogram was saved earlier, no need to count.
+            for (uint32_t i = 0; i < num_cells; i++) {
+                HistUVCell cell;
+                memcpy(&cell, stored + sizeof(num_cells) + i * sizeof(cell), sizeof(cell));
+                histUV[cell.v * 256 + cell.u] = cell.count;
             }
+
+            // Already packed, so it goes to the new file as it is.
+            if (d->export)
+                histExportPush(d->export, n, stored, stored_size);
         }
+        else if (d->export) {
+            HistUVScratch *scratch = histExportTakeScratch(d->export);
 
-        int maxval = 1;
+            countFrame(fi, d->rgb, d->count, histUV, scratch->lumaUV, scratch->lastUV, srcp, src_stride, src_width, src_height, maskp, mask_stride);
 
-        // Original comment: // Should we adjust the divisor (maxval)??
+            histExportPushUV(d->export, n, histUV, scratch);
 
-        // Draw the luma.
-        for (y = 0; y < 256; y++) {
-            for (x = 0; x < 256; x++) {
-                int disp_val = histUV[x + y * 256] / maxval;
-                if (y < 16 || y > 240 || x < 16 || x > 240) {
-                    disp_val -= 16;
-                }
-                dstp[Y][src_width[Y] + y * dst_stride[Y] + x] = MIN(235, 16 + disp_val);
-            }
+            histExportReturnScratch(d->export, scratch);
+        }
+        else {
+            countFrame(fi, d->rgb, d->count, histUV, NULL, NULL, srcp, src_stride, src_width, src_height, maskp, mask_stride);
         }
 
-        int subW = fi->subSamplingW;
-        int subH = fi->subSamplingH;
+        // The comparison clip's histogram is too big for the stack.
+        int *histUV2 = NULL;
+        if (cmp) {
+            const uint8_t *cmpp[3];
+            int cmp_stride[3];
 
-        // Draw the chroma.
-        for (y = 0; y < (256 >> subH); y++) {
-            for (x = 0; x < (256 >> subW); x++) {
-                dstp[U][src_width[U] + y * dst_stride[U] + x] = x << subW;
-                dstp[V][src_width[V] + y * dst_stride[V] + x] = y << subH;
+            for (plane = 0; plane < fi->numPlanes; plane++) {
+                cmpp[plane] = vsapi->getReadPtr(cmp, plane);
+                cmp_stride[plane] = vsapi->getStride(cmp, plane);
             }
-        }
 
-        // Clear the luma under the histogram.
-        for (y = 256; y < dst_height[Y]; y++) {
-            memset(dstp[Y] + src_width[Y] + y * dst_stride[Y], 16, 256);
+            histUV2 = (int *)calloc(256 * 256, sizeof(int));
+            countFrame(fi, d->rgb, d->count, histUV2, NULL, NULL, cmpp, cmp_stride, src_width, src_height, maskp, mask_stride);
         }
 
-        // Clear the chroma under the histogram.
-        for (y = (256 >> subH); y < dst_height[U]; y++) {
-            // The third argument was originally "(256 >> subW) - 1",
-            // leaving the last column uninitialised. (Why?)
-            memset(dstp[U] + src_width[U] + y * dst_stride[U], 128, 256 >> subW);
-            memset(dstp[V] + src_width[V] + y * dst_stride[V], 128, 256 >> subW);
-        }
+        panelBlit(&d->panel, panelp, dst_stride, dst_height);
+
+        drawUV(panelp, dst_stride, histUV, histUV2, d->diff, d->rgb, d->panel.zoom);
+
+        free(histUV2);
 
         vsapi->freeFrame(src);
+        vsapi->freeFrame(mask);
+        vsapi->freeFrame(cmp);
 
         return dst;
     }
@@ -129,6 +348,12 @@ static const VSFrame *VS_CC colorGetFrame(int n, int activationReason, void *ins
 static void VS_CC colorFree(void *instanceData, VSCore *core, const VSAPI *vsapi) {
     ColorData *d = (ColorData *)instanceData;
     vsapi->freeNode(d->node);
+    vsapi->freeNode(d->mask);
+    vsapi->freeNode(d->compare);
+    histExportClose(d->export);
+    histIndexClose(d->index);
+    panelFree(&d->panel);
+    free(d->rgb);
     free(d);
 }
 
@@ -136,24 +361,150 @@ static void VS_CC colorFree(void *instanceData, VSCore *core, const VSAPI *vsapi
 void VS_CC colorCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
     ColorData d;
     ColorData *data;
+    int err;
 
     d.node = vsapi->mapGetNode(in, "clip", 0, 0);
     d.vi = *vsapi->getVideoInfo(d.node);
 
-    if (!vsh_isConstantVideoFormat(&d.vi) || d.vi.format.sampleType != stInteger || d.vi.format.bitsPerSample != 8) {
-        vsapi->mapSetError(out, "Color: only constant format 8bit integer input supported");
+    d.mask = vsapi->mapGetNode(in, "mask", 0, &err);
+    d.compare = vsapi->mapGetNode(in, "compare", 0, &err);
+
+    d.diff = !!vsapi->mapGetInt(in, "diff", 0, &err);
+
+    if (!vsh_isConstantVideoFormat(&d.vi) || d.vi.format.colorFamily == cfGray || d.vi.format.sampleType != stInteger || d.vi.format.bitsPerSample != 8) {
+        vsapi->mapSetError(out, "Color: only constant format 8bit integer YUV or RGB input supported");
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
+        return;
+    }
+
+    d.size = vsapi->mapGetIntSaturated(in, "size", 0, &err);
+    if (err)
+        d.size = 256;
+
+    if (d.size != 128 && d.size != 256 && d.size != 512) {
+        vsapi->mapSetError(out, "Color: size must be 128, 256 or 512");
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
+        return;
+    }
+
+    if (d.mask && !checkMask(vsapi->getVideoInfo(d.mask), &d.vi)) {
+        vsapi->mapSetError(out, "Color: mask must be a constant format 8bit integer clip with the same dimensions as clip");
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
+        return;
+    }
+
+    if (d.compare && !checkCompare(vsapi->getVideoInfo(d.compare), &d.vi)) {
+        vsapi->mapSetError(out, "Color: compare must have the same format and dimensions as clip");
         vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
         return;
     }
 
+    const HistSettings settings = { .masked = !!d.mask };
+
+    if (!openExportAndIndex(in, out, "Color", HIST_KIND_UV, &d.vi, &settings, &d.export, &d.index, vsapi)) {
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
+        return;
+    }
+
+    d.rgb = NULL;
+    d.count = NULL;
+
+    if (d.vi.format.colorFamily == cfRGB) {
+        // The chroma depends on the luma, so the whole panel is drawn every frame.
+        const uint8_t fill[3] = { 0, 0, 0 };
+
+        panelInit(&d.panel, &d.vi.format, 256, 256, fill);
+
+        d.rgb = (RGBTables *)malloc(sizeof(RGBTables));
+        rgbTablesInit(d.rgb, 0.299, 0.114);
+    }
+    else {
+        d.count = selectCountUV(d.vi.format.subSamplingW, d.vi.format.subSamplingH);
+
+        // The chroma of the panel is the same in every frame.
+        const uint8_t fill[3] = { 16, 128, 128 };
+        const int subW = d.vi.format.subSamplingW;
+        const int subH = d.vi.format.subSamplingH;
+
+        panelInit(&d.panel, &d.vi.format, 256, 256, fill);
+
+        for (int y = 0; y < (256 >> subH); y++) {
+            for (int x = 0; x < (256 >> subW); x++) {
+                d.panel.data[U][y * d.panel.width[U] + x] = x << subW;
+                d.panel.data[V][y * d.panel.width[V] + x] = y << subH;
+            }
+        }
+    }
+
+    panelScale(&d.panel, d.size);
+
     if (d.vi.width)
-        d.vi.width += 256;
+        d.vi.width += d.size;
     if (d.vi.height)
-        d.vi.height = MAX(256, d.vi.height);
+        d.vi.height = MAX(d.size, d.vi.height);
 
     data = (ColorData *)malloc(sizeof(d));
     *data = d;
 
-    VSFilterDependency deps[] = { {d.node, rpStrictSpatial} };
-    vsapi->createVideoFilter(out, "Color", &d.vi, colorGetFrame, colorFree, fmParallel, deps, 1, data, core);
+    VSFilterDependency deps[3] = { {d.node, rpStrictSpatial} };
+    int numDeps = 1;
+    if (d.mask)
+        deps[numDeps++] = (VSFilterDependency){ d.mask, rpStrictSpatial };
+    if (d.compare)
+        deps[numDeps++] = (VSFilterDependency){ d.compare, rpStrictSpatial };
+
+    vsapi->createVideoFilter(out, "Color", &d.vi, colorGetFrame, colorFree, fmParallel, deps, numDeps, data, core);
+}
+
+
+static void benchCountWith(const BenchFrame *f, CountUVFunc count, int masked) {
+    int *histUV = (int *)calloc(256 * 256, sizeof(int));
+    countFrame(f->fi, f->rgb, count, histUV, NULL, NULL, f->srcp, f->src_stride, f->width, f->height, masked ? f->maskp : NULL, f->mask_stride);
+    free(histUV);
+}
+
+
+static void benchCount(const BenchFrame *f, const void *data) {
+    benchCountWith(f, selectCountUV(f->fi->subSamplingW, f->fi->subSamplingH), 0);
+}
+
+
+static void benchCountMasked(const BenchFrame *f, const void *data) {
+    benchCountWith(f, selectCountUV(f->fi->subSamplingW, f->fi->subSamplingH), 1);
+}
+
+
+static void benchCountGeneric(const BenchFrame *f, const void *data) {
+    benchCountWith(f, countUVGeneric, 0);
+}
+
+
+static void benchDraw(const BenchFrame *f, const void *data) {
+    uint8_t *dstp[3] = { f->dstp[0], f->dstp[1], f->dstp[2] };
+    drawUV(dstp, f->dst_stride, f->histUV, NULL, 0, f->rgb, 0);
+}
+
+
+int colorBenchKernels(const VSVideoFormat *fi, BenchKernel kernels[BENCH_MAX_KERNELS], void **data) {
+    if (fi->colorFamily == cfGray || fi->sampleType != stInteger || fi->bitsPerSample != 8)
+        return 0;
+
+    kernels[0] = (BenchKernel){ "count", benchCount };
+    kernels[1] = (BenchKernel){ "count_masked", benchCountMasked };
+    kernels[2] = (BenchKernel){ "draw", benchDraw };
+    if (fi->colorFamily == cfRGB)
+        return 3;
+
+    kernels[3] = (BenchKernel){ "count_generic", benchCountGeneric };
+    return 4;
 }
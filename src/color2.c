@@ -1,32 +1,515 @@
 #include <math.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <VapourSynth4.h>
 #include "VSHelper4.h"
 
+#include "bench.h"
 #include "common.h"
+#include "export.h"
+#include "histindex.h"
+#include "panel.h"
+#include "rgb.h"
+
+// The hue and saturation bins of one chroma value.
+typedef struct {
+    uint8_t hue;
+    uint8_t sat;
+} PolarBin;
+
+typedef void (*PlotUVFunc)(uint8_t *dstp[3], const int dst_stride[3], const uint8_t *srcp[3], const int src_stride[3], int width, int height, const uint8_t *maskp, int mask_stride, int *histUV, uint8_t *lumaUV, int *lastUV, int hist_polar[2][256], const PolarBin *polar, int subW, int subH, int zoom);
+
+enum GraticuleMatrix {
+    GRATICULE_601,
+    GRATICULE_709,
+    GRATICULE_2020,
+    GRATICULE_COUNT
+};
 
 typedef struct {
     VSNode *node;
+    VSNode *mask;
     VSVideoInfo vi;
-
-    int deg15cos[24];
-    int deg15sin[24];
+    int size;
+    int polar_panels;
+    int graticule;
+
+    HistExport *export;
+    HistIndex *index;
+
+    // Chosen in color2Create.
+    PlotUVFunc plot;
+    Panel panel;
+    RGBTables *rgb; // Only for RGB clips.
+    PolarBin *polar; // 256 * 256, indexed by v * 256 + u. Only with polar.
+
+    // The panel with each matrix's graticule on it, made the first time a
+    // frame needs it. Empty until its ready flag is set, the lock is only
+    // taken to make it.
+    pthread_mutex_t graticule_lock;
+    atomic_int graticule_ready[GRATICULE_COUNT];
+    Panel graticules[GRATICULE_COUNT];
 } Color2Data;
 
 
+// With polar, the hue and saturation histograms are drawn below the
+// vectorscope, each POLAR_GRAPH rows tall, with a strip of the hues
+// between them.
+#define POLAR_HUE_BOTTOM 319
+#define POLAR_LEGEND_TOP 320
+#define POLAR_LEGEND_BOTTOM 327
+#define POLAR_SAT_BOTTOM 383
+#define POLAR_GRAPH 52
+#define POLAR_PANEL_HEIGHT 384
+
+#define PI 3.14159265358979323846
+
+
+// The hue is the angle from the +U axis towards +V, in 256 bins for the
+// whole circle. The saturation is the distance from grey, scaled by sqrt(2)
+// so the corners of the UV plane still fit in 256 bins (the 100% colours
+// are around 167). Grey itself is the only value in saturation bin 0 and
+// has no hue.
+static PolarBin *makePolarTable(void) {
+    PolarBin *polar = (PolarBin *)malloc(256 * 256 * sizeof(PolarBin));
+
+    for (int v = 0; v < 256; v++) {
+        for (int u = 0; u < 256; u++) {
+            const double angle = atan2(v - 128, u - 128);
+            const double distance = sqrt((double)((u - 128) * (u - 128) + (v - 128) * (v - 128)));
+
+            polar[v * 256 + u].hue = (uint8_t)((int)floor(angle * 128.0 / PI + 256.0) & 255);
+            polar[v * 256 + u].sat = (uint8_t)MIN(255, (int)(distance * 1.41421356 + 0.5));
+        }
+    }
+
+    return polar;
+}
+
+
+// One plotting loop per chroma subsampling and panel size, so the shifts
+// are constants. dstp points to the top left corner of the panel, which is
+// 256 px scaled by 2^ZOOM: at 512 every chroma value is plotted as a 2x2
+// block, at 128 2x2 chroma values share a pixel. histUV, lumaUV and lastUV
+// are only filled when histUV is not NULL, hist_polar (hue, then
+// saturation) only when it's not NULL.
+#define PLOT_UV(name, SUBW, SUBH, ZOOM) \
+static void name(uint8_t *dstp[3], const int dst_stride[3], const uint8_t *srcp[3], const int src_stride[3], int width, int height, const uint8_t *maskp, int mask_stride, int *histUV, uint8_t *lumaUV, int *lastUV, int hist_polar[2][256], const PolarBin *polar, int subW, int subH, int zoom) { \
+    int x, y; \
+    \
+    for (y = 0; y < height; y++) { \
+        const uint8_t *srcpY = srcp[Y] + (y << (SUBH)) * src_stride[Y]; \
+        const uint8_t *srcpU = srcp[U] + y * src_stride[U]; \
+        const uint8_t *srcpV = srcp[V] + y * src_stride[V]; \
+        const uint8_t *maskrow = maskp ? maskp + (y << (SUBH)) * mask_stride : NULL; \
+        \
+        for (x = 0; x < width; x++) { \
+            if (maskrow && !maskrow[x << (SUBW)]) \
+                continue; \
+            \
+            const int uval = srcpU[x]; \
+            const int vval = srcpV[x]; \
+            const int yval = srcpY[x << (SUBW)]; \
+            \
+            for (int i = 0; i < ((ZOOM) > 0 ? 2 : 1); i++) { \
+                for (int j = 0; j < ((ZOOM) > 0 ? 2 : 1); j++) { \
+                    const int px = panelPos(ZOOM, uval) + j; \
+                    const int py = panelPos(ZOOM, vval) + i; \
+                    \
+                    dstp[Y][px + py * dst_stride[Y]] = yval; \
+                    dstp[U][(px >> (SUBW)) + (py >> (SUBH)) * dst_stride[U]] = uval; \
+                    dstp[V][(px >> (SUBW)) + (py >> (SUBH)) * dst_stride[V]] = vval; \
+                } \
+            } \
+            \
+            if (histUV) { \
+                histUV[vval * 256 + uval]++; \
+                lumaUV[vval * 256 + uval] = yval; \
+                lastUV[vval * 256 + uval] = y * width + x; \
+            } \
+            \
+            if (hist_polar) { \
+                const PolarBin bin = polar[vval * 256 + uval]; \
+                if (bin.sat) \
+                    hist_polar[0][bin.hue]++; \
+                hist_polar[1][bin.sat]++; \
+            } \
+        } \
+    } \
+}
+
+#define PLOT_UV_ZOOMS(name, SUBW, SUBH) \
+PLOT_UV(name##Half, SUBW, SUBH, -1) \
+PLOT_UV(name, SUBW, SUBH, 0) \
+PLOT_UV(name##Double, SUBW, SUBH, 1)
+
+PLOT_UV(plotUVGeneric, subW, subH, zoom)
+PLOT_UV_ZOOMS(plotUV00, 0, 0)
+PLOT_UV_ZOOMS(plotUV01, 0, 1)
+PLOT_UV_ZOOMS(plotUV02, 0, 2)
+PLOT_UV_ZOOMS(plotUV10, 1, 0)
+PLOT_UV_ZOOMS(plotUV11, 1, 1)
+PLOT_UV_ZOOMS(plotUV12, 1, 2)
+PLOT_UV_ZOOMS(plotUV20, 2, 0)
+PLOT_UV_ZOOMS(plotUV21, 2, 1)
+PLOT_UV_ZOOMS(plotUV22, 2, 2)
+
+
+static PlotUVFunc selectPlotUV(int subW, int subH, int zoom) {
+    static const PlotUVFunc funcs[3][3][3] = {
+        {
+            { plotUV00Half, plotUV01Half, plotUV02Half },
+            { plotUV10Half, plotUV11Half, plotUV12Half },
+            { plotUV20Half, plotUV21Half, plotUV22Half }
+        },
+        {
+            { plotUV00, plotUV01, plotUV02 },
+            { plotUV10, plotUV11, plotUV12 },
+            { plotUV20, plotUV21, plotUV22 }
+        },
+        {
+            { plotUV00Double, plotUV01Double, plotUV02Double },
+            { plotUV10Double, plotUV11Double, plotUV12Double },
+            { plotUV20Double, plotUV21Double, plotUV22Double }
+        }
+    };
+
+    if (subW <= 2 && subH <= 2)
+        return funcs[zoom + 1][subW][subH];
+
+    return plotUVGeneric;
+}
+
+
+// Plots one chroma value the way PLOT_UV does, or in RGB if rgb is not NULL,
+// for the RGB clips and the histograms read from the index.
+static inline void plotCell(uint8_t *dstp[3], const int dst_stride[3], int yval, int uval, int vval, int subW, int subH, int zoom, const RGBTables *rgb) {
+    const int n = zoom > 0 ? 2 : 1;
+
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            const int px = panelPos(zoom, uval) + j;
+            const int py = panelPos(zoom, vval) + i;
+
+            if (rgb) {
+                yuvToRGB(rgb, yval, uval, vval, &dstp[0][px + py * dst_stride[0]], &dstp[1][px + py * dst_stride[1]], &dstp[2][px + py * dst_stride[2]]);
+                continue;
+            }
+
+            dstp[Y][px + py * dst_stride[Y]] = yval;
+            dstp[U][(px >> subW) + (py >> subH) * dst_stride[U]] = uval;
+            dstp[V][(px >> subW) + (py >> subH) * dst_stride[V]] = vval;
+        }
+    }
+}
+
+
+// For RGB clips. Each pixel is placed according to the chroma it would
+// have in YUV and drawn in the colour it gets back from that.
+static void plotRGB(uint8_t *dstp[3], const int dst_stride[3], const uint8_t *srcp[3], const int src_stride[3], int width, int height, const uint8_t *maskp, int mask_stride, int *histUV, uint8_t *lumaUV, int *lastUV, int hist_polar[2][256], const PolarBin *polar, const RGBTables *t, int zoom) {
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        const uint8_t *r = srcp[0] + y * src_stride[0];
+        const uint8_t *g = srcp[1] + y * src_stride[1];
+        const uint8_t *b = srcp[2] + y * src_stride[2];
+        const uint8_t *maskrow = maskp ? maskp + y * mask_stride : NULL;
+
+        for (x = 0; x < width; x++) {
+            if (maskrow && !maskrow[x])
+                continue;
+
+            int yval, uval, vval;
+            rgbToYUV(t, r[x], g[x], b[x], &yval, &uval, &vval);
+
+            plotCell(dstp, dst_stride, yval, uval, vval, 0, 0, zoom, t);
+
+            if (histUV) {
+                histUV[vval * 256 + uval]++;
+                lumaUV[vval * 256 + uval] = yval;
+                lastUV[vval * 256 + uval] = y * width + x;
+            }
+
+            if (hist_polar) {
+                const PolarBin bin = polar[vval * 256 + uval];
+                if (bin.sat)
+                    hist_polar[0][bin.hue]++;
+                hist_polar[1][bin.sat]++;
+            }
+        }
+    }
+}
+
+
+static void drawBackground(uint8_t *dstp[3], const int dst_stride[3], const int deg15cos[24], const int deg15sin[24], int subW, int subH) {
+    int x, y;
+
+    // Draw the gray square.
+    memset(dstp[Y] + 16 * dst_stride[Y] + 16, 128, 225); // top
+    memset(dstp[Y] + 240 * dst_stride[Y] + 16, 128, 225); // bottom
+    for (y = 17; y < 240; y++) {
+        dstp[Y][y * dst_stride[Y] + 16] = 128;
+        dstp[Y][y * dst_stride[Y] + 240] = 128;
+    }
+
+    // Original comments:
+    // six hues in the color-wheel:
+    // LC[3j,3j+1,3j+2], RC[3j,3j+1,3j+2] in YRange[j]+1 and YRange[j+1]
+    int Yrange[8] = { -1, 26, 104, 127, 191, 197, 248, 256 };
+    // 2x green, 2x yellow, 3x red
+    int LC[21] = { 145,54,34, 145,54,34, 210,16,146, 210,16,146, 81,90,240, 81,90,240, 81,90,240 };
+    // cyan, 4x blue, magenta, red:
+    int RC[21] = { 170,166,16, 41,240,110, 41,240,110, 41,240,110, 41,240,110, 106,202,222, 81,90,240 };
+
+    // example boundary of cyan and blue:
+    // red = min(r,g,b), blue if g < 2/3 b, green if b < 2/3 g.
+    // cyan between green and blue.
+    // thus boundary of cyan and blue at (r,g,b) = (0,170,255), since 2/3*255 = 170.
+    // => yuv = (127,190,47); hue = -52 degr; sat = 103
+    // => u'v' = (207,27) (same hue, sat=128)
+    // similar for the other hues.
+    // luma
+
+    float innerF = 124.9f; // .9 is for better visuals in subsampled mode
+    float thicknessF = 1.5f;
+    float oneOverThicknessF = 1.0f / thicknessF;
+    float outerF = innerF + thicknessF * 2.0f;
+    float centerF = innerF + thicknessF;
+    int innerSq = (int)(innerF * innerF);
+    int outerSq = (int)(outerF * outerF);
+    int activeY = 0;
+    int xRounder = (1 << subW) / 2;
+    int yRounder = (1 << subH) / 2;
+
+    // Draw the circle.
+    for (y = -127; y < 128; y++) {
+        if (y + 127 > Yrange[activeY + 1]) {
+            activeY++;
+        }
+        for (x = -127; x <= 0; x++) {
+            int distSq = x * x + y * y;
+            if (distSq <= outerSq && distSq >= innerSq) {
+                int interp = (int)(256.0f - (255.9f * (oneOverThicknessF * fabs(sqrt((float)distSq) - centerF))));
+                // 255.9 is to account for float imprecision, which could cause underflow.
+
+                int xP = 127 + x;
+                int yP = 127 + y;
+
+                dstp[Y][xP + yP * dst_stride[Y]] = (interp * LC[3 * activeY]) >> 8; // left upper half
+                dstp[Y][255 - xP + yP * dst_stride[Y]] = (interp * RC[3 * activeY]) >> 8; // right upper half
+
+                // Rounding would put the bottom of the circle one row past
+                // the end of the panel when subH is 2.
+                xP = (xP + xRounder) >> subW;
+                yP = MIN((yP + yRounder) >> subH, 255 >> subH);
+
+                interp = MIN(256, interp);
+                int invInt = 256 - interp;
+
+                dstp[U][xP + yP * dst_stride[U]] = (dstp[U][xP + yP * dst_stride[U]] * invInt + interp * LC[3 * activeY + 1]) >> 8; // left half
+                dstp[V][xP + yP * dst_stride[V]] = (dstp[V][xP + yP * dst_stride[V]] * invInt + interp * LC[3 * activeY + 2]) >> 8; // left half
+
+                xP = (255 >> subW) - xP;
+                dstp[U][xP + yP * dst_stride[U]] = (dstp[U][xP + yP * dst_stride[U]] * invInt + interp * RC[3 * activeY + 1]) >> 8; // left half
+                dstp[V][xP + yP * dst_stride[V]] = (dstp[V][xP + yP * dst_stride[V]] * invInt + interp * RC[3 * activeY + 2]) >> 8; // left half
+            }
+        }
+    }
+
+    // Draw the white dots every 15 degrees.
+    for (int i = 0; i < 24; i++) {
+        dstp[Y][deg15cos[i] + deg15sin[i] * dst_stride[Y]] = 235;
+    }
+}
+
+
+// The strip of hues between the two graphs, in the panel template.
+static void drawPolarLegend(uint8_t *dstp[3], const int dst_stride[3], int subW, int subH) {
+    for (int y = POLAR_LEGEND_TOP; y <= POLAR_LEGEND_BOTTOM; y++)
+        memset(dstp[Y] + y * dst_stride[Y], 126, 256);
+
+    for (int y = POLAR_LEGEND_TOP >> subH; y <= POLAR_LEGEND_BOTTOM >> subH; y++) {
+        for (int x = 0; x < 256 >> subW; x++) {
+            const double angle = (((x << subW) + 0.5) / 128.0 - 1.0) * PI;
+
+            dstp[U][y * dst_stride[U] + x] = (uint8_t)(128.5 + 80.0 * cos(angle));
+            dstp[V][y * dst_stride[V] + x] = (uint8_t)(128.5 + 80.0 * sin(angle));
+        }
+    }
+}
+
+
+// The bars are scaled to the tallest one. The legend starts at -180
+// degrees, so the hue graph is drawn rotated by half a turn to match it.
+// At 128 px two bins go in every column.
+static void drawPolarGraphs(uint8_t *dstp[3], const int dst_stride[3], int hist_polar[2][256], int rgb, int zoom) {
+    static const int bottoms[2] = { POLAR_HUE_BOTTOM, POLAR_SAT_BOTTOM };
+    const int width = panelPos(zoom, 256);
+    const int step = panelStep(zoom);
+
+    for (int graph = 0; graph < 2; graph++) {
+        int bars[512];
+        int peak = 0;
+
+        for (int x = 0; x < width; x++) {
+            const int bin = (x << 1) >> (zoom + 1);
+
+            bars[x] = 0;
+            for (int i = bin; i < bin + step; i++)
+                bars[x] += hist_polar[graph][graph ? i : (i + 128) & 255];
+            peak = MAX(peak, bars[x]);
+        }
+
+        if (!peak)
+            continue;
+
+        const int bottom = panelLast(zoom, bottoms[graph]);
+
+        for (int x = 0; x < width; x++) {
+            const int height = (int)(((int64_t)bars[x] * panelPos(zoom, POLAR_GRAPH) + peak - 1) / peak);
+
+            for (int y = bottom - height + 1; y <= bottom; y++) {
+                if (rgb) {
+                    for (int plane = 0; plane < 3; plane++)
+                        dstp[plane][y * dst_stride[plane] + x] = 255;
+                }
+                else {
+                    dstp[Y][y * dst_stride[Y] + x] = 235;
+                }
+            }
+        }
+    }
+}
+
+
+// Where the limited range chroma of an RGB colour (0 to 1) lands in the
+// panel.
+static void chromaPosition(double r, double g, double b, double kr, double kb, int *x, int *y) {
+    const double luma = kr * r + (1.0 - kr - kb) * g + kb * b;
+
+    *x = (int)floor(128.5 + 224.0 * (b - luma) / (2.0 * (1.0 - kb)));
+    *y = (int)floor(128.5 + 224.0 * (r - luma) / (2.0 * (1.0 - kr)));
+}
+
+
+// x and y are in the 256 px layout, the dot covers them in the scaled panel.
+static void drawGraticuleDot(Panel *p, int x, int y, int value, int rgb) {
+    if (x < 0 || x > 255 || y < 0 || y > 255)
+        return;
+
+    const int n = p->zoom > 0 ? 2 : 1;
+
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            const int pos = (panelPos(p->zoom, y) + i) * p->width[0] + panelPos(p->zoom, x) + j;
+
+            if (rgb) {
+                for (int plane = 0; plane < 3; plane++)
+                    p->data[plane][pos] = (uint8_t)((value - 16) * 255 / 219);
+            }
+            else {
+                p->data[Y][pos] = (uint8_t)value;
+            }
+        }
+    }
+}
+
+
+// Copies the panel and draws on it, in luma only, where the 75% and 100%
+// colour bars land with the matrix (a small and a big square around each),
+// and the skin tone line. The line is the +I axis of YIQ, which is where it
+// is usually drawn for BT.601, made into RGB and back with the matrix.
+static void makeGraticule(Panel *dst, const Panel *background, int matrix, int rgb) {
+    static const double kr[GRATICULE_COUNT] = { 0.299, 0.2126, 0.2627 };
+    static const double kb[GRATICULE_COUNT] = { 0.114, 0.0722, 0.0593 };
+
+    panelCopy(dst, background);
+
+    for (int colour = 1; colour < 7; colour++) {
+        for (int full = 0; full < 2; full++) {
+            const double level = full ? 1.0 : 0.75;
+            const int half = full ? 4 : 2;
+            const int value = full ? 235 : 180;
+            int x, y;
+
+            chromaPosition(level * (colour >> 2 & 1), level * (colour >> 1 & 1), level * (colour & 1), kr[matrix], kb[matrix], &x, &y);
+
+            for (int i = -half; i <= half; i++) {
+                drawGraticuleDot(dst, x + i, y - half, value, rgb);
+                drawGraticuleDot(dst, x + i, y + half, value, rgb);
+                drawGraticuleDot(dst, x - half, y + i, value, rgb);
+                drawGraticuleDot(dst, x + half, y + i, value, rgb);
+            }
+        }
+    }
+
+    // The luma of I is only 0 with the BT.601 coefficients.
+    const double i_r = 0.956, i_g = -0.272, i_b = -1.106;
+    const double luma = kr[matrix] * i_r + (1.0 - kr[matrix] - kb[matrix]) * i_g + kb[matrix] * i_b;
+    const double du = (i_b - luma) / (2.0 * (1.0 - kb[matrix]));
+    const double dv = (i_r - luma) / (2.0 * (1.0 - kr[matrix]));
+    const double length = sqrt(du * du + dv * dv);
+
+    for (int t = 8; t < 250; t++) {
+        const double distance = t * 0.5;
+        drawGraticuleDot(dst, (int)floor(128.5 + distance * du / length), (int)floor(128.5 + distance * dv / length), 160, rgb);
+    }
+}
+
+
+// Picks the graticule from the frame's _Matrix, BT.601 unless it says
+// BT.709 or BT.2020. RGB clips always go through BT.601, see rgbTablesInit.
+static const Panel *getGraticule(Color2Data *d, const VSFrame *src, const VSAPI *vsapi) {
+    int matrix = GRATICULE_601;
+
+    if (!d->rgb) {
+        int err;
+        const int64_t value = vsapi->mapGetInt(vsapi->getFramePropertiesRO(src), "_Matrix", 0, &err);
+
+        if (!err && value == VSC_MATRIX_BT709)
+            matrix = GRATICULE_709;
+        else if (!err && (value == VSC_MATRIX_BT2020_NCL || value == VSC_MATRIX_BT2020_CL))
+            matrix = GRATICULE_2020;
+    }
+
+    if (atomic_load_explicit(&d->graticule_ready[matrix], memory_order_acquire))
+        return &d->graticules[matrix];
+
+    pthread_mutex_lock(&d->graticule_lock);
+    if (!atomic_load_explicit(&d->graticule_ready[matrix], memory_order_relaxed)) {
+        makeGraticule(&d->graticules[matrix], &d->panel, matrix, !!d->rgb);
+        atomic_store_explicit(&d->graticule_ready[matrix], 1, memory_order_release);
+    }
+    pthread_mutex_unlock(&d->graticule_lock);
+
+    return &d->graticules[matrix];
+}
+
+
+// Frames whose histograms come from the index don't need the mask.
+static int needsMask(const Color2Data *d, int n) {
+    uint32_t size;
+    return d->mask && (!d->index || !histIndexGet(d->index, n, &size));
+}
+
+
 static const VSFrame *VS_CC color2GetFrame(int n, int activationReason, void *instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
     Color2Data *d = (Color2Data *) instanceData;
 
     if (activationReason == arInitial) {
         vsapi->requestFrameFilter(n, d->node, frameCtx);
+        if (needsMask(d, n))
+            vsapi->requestFrameFilter(n, d->mask, frameCtx);
     }
     else if (activationReason == arAllFramesReady) {
         const VSFrame *src = vsapi->getFrameFilter(n, d->node, frameCtx);
+        const VSFrame *mask = needsMask(d, n) ? vsapi->getFrameFilter(n, d->mask, frameCtx) : NULL;
 
         const VSVideoFormat* fi = &d->vi.format;
-        int height = MAX(256, vsapi->getFrameHeight(src, 0));
-        int width = vsapi->getFrameWidth(src, 0) + 256;
+        int height = MAX(d->polar ? d->size * POLAR_PANEL_HEIGHT / 256 : d->size, vsapi->getFrameHeight(src, 0));
+        int width = vsapi->getFrameWidth(src, 0) + d->size;
 
         VSFrame *dst = vsapi->newVideoFrame(fi, width, height, src, core);
 
@@ -41,8 +524,9 @@ static const VSFrame *VS_CC color2GetFrame(int n, int activationReason, void *in
 
         int dst_height[3];
 
+        uint8_t *panelp[3];
+
         int y;
-        int x;
 
         int plane;
 
@@ -58,6 +542,8 @@ static const VSFrame *VS_CC color2GetFrame(int n, int activationReason, void *in
 
             dst_height[plane] = vsapi->getFrameHeight(dst, plane);
 
+            panelp[plane] = dstp[plane] + src_width[plane];
+
             // Copy src to dst one line at a time.
             for (y = 0; y < src_height[plane]; y++) {
                 memcpy(dstp[plane] + dst_stride[plane] * y,
@@ -65,118 +551,81 @@ static const VSFrame *VS_CC color2GetFrame(int n, int activationReason, void *in
                     src_stride[plane]);
             }
 
-            // If src was less than 256 px tall, make the extra lines black.
+            // If src was less than the panel, make the extra lines black.
             if (src_height[plane] < dst_height[plane]) {
                 memset(dstp[plane] + src_height[plane] * dst_stride[plane],
-                    (plane == 0) ? 16 : 128,
+                    d->rgb ? 0 : (plane == 0) ? 16 : 128,
                     (dst_height[plane] - src_height[plane]) * dst_stride[plane]);
             }
         }
 
-        // Clear the luma.
-        for (y = 0; y < dst_height[Y]; y++) {
-            memset(dstp[Y] + src_width[Y] + y * dst_stride[Y], 16, 256);
-        }
-
         int subW = fi->subSamplingW;
         int subH = fi->subSamplingH;
 
-        // Clear the chroma.
-        for (y = 0; y < dst_height[U]; y++) {
-            memset(dstp[U] + src_width[U] + y * dst_stride[U], 128, 256 >> subW);
-            memset(dstp[V] + src_width[V] + y * dst_stride[V], 128, 256 >> subW);
-        }
-
-        // Draw the gray square.
-        memset(dstp[Y] + src_width[Y] + 16 * dst_stride[Y] + 16, 128, 225); // top
-        memset(dstp[Y] + src_width[Y] + 240 * dst_stride[Y] + 16, 128, 225); // bottom
-        for (y = 17; y < 240; y++) {
-            dstp[Y][src_width[Y] + y * dst_stride[Y] + 16] = 128;
-            dstp[Y][src_width[Y] + y * dst_stride[Y] + 240] = 128;
-        }
-
-        // Original comments:
-        // six hues in the color-wheel:
-        // LC[3j,3j+1,3j+2], RC[3j,3j+1,3j+2] in YRange[j]+1 and YRange[j+1]
-        int Yrange[8] = { -1, 26, 104, 127, 191, 197, 248, 256 };
-        // 2x green, 2x yellow, 3x red
-        int LC[21] = { 145,54,34, 145,54,34, 210,16,146, 210,16,146, 81,90,240, 81,90,240, 81,90,240 };
-        // cyan, 4x blue, magenta, red:
-        int RC[21] = { 170,166,16, 41,240,110, 41,240,110, 41,240,110, 41,240,110, 106,202,222, 81,90,240 };
-
-        // example boundary of cyan and blue:
-        // red = min(r,g,b), blue if g < 2/3 b, green if b < 2/3 g.
-        // cyan between green and blue.
-        // thus boundary of cyan and blue at (r,g,b) = (0,170,255), since 2/3*255 = 170.
-        // => yuv = (127,190,47); hue = -52 degr; sat = 103
-        // => u'v' = (207,27) (same hue, sat=128)
-        // similar for the other hues.
-        // luma
-
-        float innerF = 124.9f; // .9 is for better visuals in subsampled mode
-        float thicknessF = 1.5f;
-        float oneOverThicknessF = 1.0f / thicknessF;
-        float outerF = innerF + thicknessF * 2.0f;
-        float centerF = innerF + thicknessF;
-        int innerSq = (int)(innerF * innerF);
-        int outerSq = (int)(outerF * outerF);
-        int activeY = 0;
-        int xRounder = (1 << subW) / 2;
-        int yRounder = (1 << subH) / 2;
-
-        // Draw the circle.
-        for (y = -127; y < 128; y++) {
-            if (y + 127 > Yrange[activeY + 1]) {
-                activeY++;
-            }
-            for (x = -127; x <= 0; x++) {
-                int distSq = x * x + y * y;
-                if (distSq <= outerSq && distSq >= innerSq) {
-                    int interp = (int)(256.0f - (255.9f * (oneOverThicknessF * fabs(sqrt((float)distSq) - centerF))));
-                    // 255.9 is to account for float imprecision, which could cause underflow.
+        const Panel *panel = d->graticule ? getGraticule(d, src, vsapi) : &d->panel;
 
-                    int xP = 127 + x;
-                    int yP = 127 + y;
+        panelBlit(panel, panelp, dst_stride, dst_height);
 
-                    dstp[Y][src_width[Y] + xP + yP * dst_stride[Y]] = (interp * LC[3 * activeY]) >> 8; // left upper half
-                    dstp[Y][src_width[Y] + 255 - xP + yP * dst_stride[Y]] = (interp * RC[3 * activeY]) >> 8; // right upper half
+        int hist_polar[2][256] = { { 0 } };
 
-                    xP = (xP + xRounder) >> subW;
-                    yP = (yP + yRounder) >> subH;
+        uint32_t stored_size = 0;
+        const uint8_t *stored = d->index ? histIndexGet(d->index, n, &stored_size) : NULL;
 
-                    interp = MIN(256, interp);
-                    int invInt = 256 - interp;
+        if (stored) {
+            uint32_t num_cells;
+            memcpy(&num_cells, stored, sizeof(num_cells));
 
-                    dstp[U][src_width[U] + xP + yP * dst_stride[U]] = (dstp[U][src_width[U] + xP + yP * dst_stride[U]] * invInt + interp * LC[3 * activeY + 1]) >> 8; // left half
-                    dstp[V][src_width[V] + xP + yP * dst_stride[V]] = (dstp[V][src_width[V] + xP + yP * dst_stride[V]] * invInt + interp * LC[3 * activeY + 2]) >> 8; // left half
+            // Draw the vectorscope from the saved histogram instead.
+            for (uint32_t i = 0; i < num_cells; i++) {
+                HistUVCell cell;
+                memcpy(&cell, stored + sizeof(num_cells) + i * sizeof(cell), sizeof(cell));
 
-                    xP = (255 >> subW) - xP;
-                    dstp[U][src_width[U] + xP + yP * dst_stride[U]] = (dstp[U][src_width[U] + xP + yP * dst_stride[U]] * invInt + interp * RC[3 * activeY + 1]) >> 8; // left half
-                    dstp[V][src_width[V] + xP + yP * dst_stride[V]] = (dstp[V][src_width[V] + xP + yP * dst_stride[V]] * invInt + interp * RC[3 * activeY + 2]) >> 8; // left half
+                if (d->polar) {
+                    const PolarBin bin = d->polar[cell.v * 256 + cell.u];
+                    if (bin.sat)
+                        hist_polar[0][bin.hue] += cell.count;
+                    hist_polar[1][bin.sat] += cell.count;
                 }
+
+                plotCell(panelp, dst_stride, cell.luma, cell.u, cell.v, subW, subH, panel->zoom, d->rgb);
             }
-        }
 
-        // Draw the white dots every 15 degrees.
-        for (int i = 0; i < 24; i++) {
-            dstp[Y][src_width[Y] + d->deg15cos[i] + d->deg15sin[i] * dst_stride[Y]] = 235;
+            // Already packed, so it goes to the new file as it is.
+            if (d->export)
+                histExportPush(d->export, n, stored, stored_size);
         }
-
-        // Draw the vectorscope(!).
-        for (y = 0; y < src_height[U]; y++) {
-            for (x = 0; x < src_width[U]; x++) {
-                int uval = srcp[U][x + y * src_stride[U]];
-                int vval = srcp[V][x + y * src_stride[V]];
-
-                dstp[Y][src_width[Y] + uval + vval * dst_stride[Y]] = srcp[Y][(x << subW) + y * (src_stride[Y] << subH)];
-                dstp[U][src_width[U] + (uval >> subW) + (vval >> subW) * dst_stride[U]] = uval;
-                dstp[V][src_width[V] + (uval >> subW) + (vval >> subW) * dst_stride[V]] = vval;
+        else {
+            // Only the first plane of the mask is used, sampled at the
+            // top left luma position of every chroma sample.
+            const uint8_t *maskp = mask ? vsapi->getReadPtr(mask, 0) : NULL;
+            const int mask_stride = mask ? vsapi->getStride(mask, 0) : 0;
+
+            HistUVScratch *scratch = d->export ? histExportTakeScratch(d->export) : NULL;
+            int *histUV = scratch ? scratch->histUV : NULL;
+            uint8_t *lumaUV = scratch ? scratch->lumaUV : NULL;
+            int *lastUV = scratch ? scratch->lastUV : NULL;
+
+            if (histUV)
+                memset(histUV, 0, sizeof(scratch->histUV));
+
+            // Draw the vectorscope(!).
+            if (d->rgb)
+                plotRGB(panelp, dst_stride, srcp, src_stride, src_width[0], src_height[0], maskp, mask_stride, histUV, lumaUV, lastUV, d->polar ? hist_polar : NULL, d->polar, d->rgb, panel->zoom);
+            else
+                d->plot(panelp, dst_stride, srcp, src_stride, src_width[U], src_height[U], maskp, mask_stride, histUV, lumaUV, lastUV, d->polar ? hist_polar : NULL, d->polar, subW, subH, panel->zoom);
+
+            if (scratch) {
+                histExportPushUV(d->export, n, histUV, scratch);
+                histExportReturnScratch(d->export, scratch);
             }
         }
 
+        if (d->polar)
+            drawPolarGraphs(panelp, dst_stride, hist_polar, !!d->rgb, panel->zoom);
 
         // Release the source frame
         vsapi->freeFrame(src);
+        vsapi->freeFrame(mask);
 
         // A reference is consumed when it is returned so saving the dst ref somewhere
         // and reusing it is not allowed.
@@ -190,6 +639,15 @@ static const VSFrame *VS_CC color2GetFrame(int n, int activationReason, void *in
 static void VS_CC color2Free(void *instanceData, VSCore *core, const VSAPI *vsapi) {
     Color2Data *d = (Color2Data *)instanceData;
     vsapi->freeNode(d->node);
+    vsapi->freeNode(d->mask);
+    histExportClose(d->export);
+    histIndexClose(d->index);
+    panelFree(&d->panel);
+    for (int i = 0; i < GRATICULE_COUNT; i++)
+        panelFree(&d->graticules[i]);
+    pthread_mutex_destroy(&d->graticule_lock);
+    free(d->rgb);
+    free(d->polar);
     free(d);
 }
 
@@ -197,29 +655,161 @@ static void VS_CC color2Free(void *instanceData, VSCore *core, const VSAPI *vsap
 void VS_CC color2Create(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
     Color2Data d;
     Color2Data *data;
-
-    for (int i = 0; i < 24; i++) {
-        d.deg15cos[i] = (int)(126.0 * cos(i * 3.14159 / 12.0) + 0.5) + 127;
-        d.deg15sin[i] = (int)(-126.0 * sin(i * 3.14159 / 12.0) + 0.5) + 127;
-    }
+    int err;
 
     d.node = vsapi->mapGetNode(in, "clip", 0, 0);
     d.vi = *vsapi->getVideoInfo(d.node);
 
-    if (!vsh_isConstantVideoFormat(&d.vi) || d.vi.format.sampleType != stInteger || d.vi.format.bitsPerSample != 8) {
-        vsapi->mapSetError(out, "Color2: only constant format 8bit integer input supported");
+    d.mask = vsapi->mapGetNode(in, "mask", 0, &err);
+
+    if (!vsh_isConstantVideoFormat(&d.vi) || d.vi.format.colorFamily == cfGray || d.vi.format.sampleType != stInteger || d.vi.format.bitsPerSample != 8) {
+        vsapi->mapSetError(out, "Color2: only constant format 8bit integer YUV or RGB input supported");
         vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
         return;
     }
 
+    d.size = vsapi->mapGetIntSaturated(in, "size", 0, &err);
+    if (err)
+        d.size = 256;
+
+    if (d.size != 128 && d.size != 256 && d.size != 512) {
+        vsapi->mapSetError(out, "Color2: size must be 128, 256 or 512");
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        return;
+    }
+
+    d.polar_panels = !!vsapi->mapGetInt(in, "polar", 0, &err);
+    d.graticule = !!vsapi->mapGetInt(in, "graticule", 0, &err);
+
+    if (d.mask && !checkMask(vsapi->getVideoInfo(d.mask), &d.vi)) {
+        vsapi->mapSetError(out, "Color2: mask must be a constant format 8bit integer clip with the same dimensions as clip");
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        return;
+    }
+
+    const HistSettings settings = { .masked = !!d.mask };
+
+    if (!openExportAndIndex(in, out, "Color2", HIST_KIND_UV, &d.vi, &settings, &d.export, &d.index, vsapi)) {
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        return;
+    }
+
+    d.plot = selectPlotUV(d.vi.format.subSamplingW, d.vi.format.subSamplingH, (d.size > 256) - (d.size < 256));
+    d.polar = d.polar_panels ? makePolarTable() : NULL;
+
+    // The square, the circle, the dots and the hues never change.
+    {
+        const int panel_height = d.polar ? POLAR_PANEL_HEIGHT : 256;
+        const uint8_t fill[3] = { 16, 128, 128 };
+        int deg15cos[24];
+        int deg15sin[24];
+
+        for (int i = 0; i < 24; i++) {
+            deg15cos[i] = (int)(126.0 * cos(i * 3.14159 / 12.0) + 0.5) + 127;
+            deg15sin[i] = (int)(-126.0 * sin(i * 3.14159 / 12.0) + 0.5) + 127;
+        }
+
+        if (d.vi.format.colorFamily == cfRGB) {
+            // Drawn in YUV first, then converted.
+            const uint8_t black[3] = { 0, 0, 0 };
+            VSVideoFormat yuv = d.vi.format;
+            Panel background;
+
+            yuv.colorFamily = cfYUV;
+
+            d.rgb = (RGBTables *)malloc(sizeof(RGBTables));
+            rgbTablesInit(d.rgb, 0.299, 0.114);
+
+            panelInit(&background, &yuv, 256, panel_height, fill);
+            drawBackground(background.data, background.width, deg15cos, deg15sin, 0, 0);
+            if (d.polar)
+                drawPolarLegend(background.data, background.width, 0, 0);
+
+            panelInit(&d.panel, &d.vi.format, 256, panel_height, black);
+            for (int i = 0; i < 256 * panel_height; i++)
+                yuvToRGB(d.rgb, background.data[Y][i], background.data[U][i], background.data[V][i], &d.panel.data[0][i], &d.panel.data[1][i], &d.panel.data[2][i]);
+
+            panelFree(&background);
+        }
+        else {
+            d.rgb = NULL;
+
+            panelInit(&d.panel, &d.vi.format, 256, panel_height, fill);
+            drawBackground(d.panel.data, d.panel.width, deg15cos, deg15sin, d.vi.format.subSamplingW, d.vi.format.subSamplingH);
+            if (d.polar)
+                drawPolarLegend(d.panel.data, d.panel.width, d.vi.format.subSamplingW, d.vi.format.subSamplingH);
+        }
+    }
+
+    panelScale(&d.panel, d.size);
+
     if (d.vi.width)
-        d.vi.width += 256;
+        d.vi.width += d.size;
     if (d.vi.height)
-        d.vi.height = MAX(256, d.vi.height);
+        d.vi.height = MAX(d.polar ? d.size * POLAR_PANEL_HEIGHT / 256 : d.size, d.vi.height);
+
+    memset(d.graticules, 0, sizeof(d.graticules));
 
     data = (Color2Data *)malloc(sizeof(d));
     *data = d;
 
-    VSFilterDependency deps[] = { {d.node, rpStrictSpatial} };
-    vsapi->createVideoFilter(out, "Color2", &d.vi, color2GetFrame, color2Free, fmParallel, deps, 1, data, core);
+    pthread_mutex_init(&data->graticule_lock, NULL);
+    for (int i = 0; i < GRATICULE_COUNT; i++)
+        atomic_init(&data->graticule_ready[i], 0);
+
+    VSFilterDependency deps[] = { {d.node, rpStrictSpatial}, {d.mask, rpStrictSpatial} };
+    vsapi->createVideoFilter(out, "Color2", &d.vi, color2GetFrame, color2Free, fmParallel, deps, d.mask ? 2 : 1, data, core);
+}
+
+
+static void benchPlotWith(const BenchFrame *f, PlotUVFunc plot, int masked, const PolarBin *polar) {
+    uint8_t *dstp[3] = { f->dstp[0], f->dstp[1], f->dstp[2] };
+    const uint8_t *srcp[3] = { f->srcp[0], f->srcp[1], f->srcp[2] };
+    int hist_polar[2][256] = { { 0 } };
+
+    if (f->rgb)
+        plotRGB(dstp, f->dst_stride, srcp, f->src_stride, f->width[0], f->height[0], masked ? f->maskp : NULL, f->mask_stride, NULL, NULL, NULL, polar ? hist_polar : NULL, polar, f->rgb, 0);
+    else
+        plot(dstp, f->dst_stride, srcp, f->src_stride, f->width[U], f->height[U], masked ? f->maskp : NULL, f->mask_stride, NULL, NULL, NULL, polar ? hist_polar : NULL, polar, f->fi->subSamplingW, f->fi->subSamplingH, 0);
+}
+
+
+static void benchPlot(const BenchFrame *f, const void *data) {
+    benchPlotWith(f, selectPlotUV(f->fi->subSamplingW, f->fi->subSamplingH, 0), 0, NULL);
+}
+
+
+static void benchPlotMasked(const BenchFrame *f, const void *data) {
+    benchPlotWith(f, selectPlotUV(f->fi->subSamplingW, f->fi->subSamplingH, 0), 1, NULL);
+}
+
+
+static void benchPlotGeneric(const BenchFrame *f, const void *data) {
+    benchPlotWith(f, plotUVGeneric, 0, NULL);
+}
+
+
+static void benchPlotPolar(const BenchFrame *f, const void *data) {
+    benchPlotWith(f, selectPlotUV(f->fi->subSamplingW, f->fi->subSamplingH, 0), 0, (const PolarBin *)data);
+}
+
+
+int color2BenchKernels(const VSVideoFormat *fi, BenchKernel kernels[BENCH_MAX_KERNELS], void **data) {
+    if (fi->colorFamily == cfGray || fi->sampleType != stInteger || fi->bitsPerSample != 8)
+        return 0;
+
+    *data = makePolarTable();
+
+    kernels[0] = (BenchKernel){ "plot", benchPlot };
+    kernels[1] = (BenchKernel){ "plot_masked", benchPlotMasked };
+    kernels[2] = (BenchKernel){ "plot_polar", benchPlotPolar };
+    if (fi->colorFamily == cfRGB)
+        return 3;
+
+    kernels[3] = (BenchKernel){ "plot_generic", benchPlotGeneric };
+    return 4;
 }
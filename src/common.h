@@ -1,6 +1,8 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <VapourSynth4.h>
+
 #define MIN(a, b)  (((a) < (b)) ? (a) : (b))
 #define MAX(a, b)  (((a) > (b)) ? (a) : (b))
 
@@ -10,4 +12,31 @@ enum yuv_planes {
     V
 };
 
+// A mask clip is usable if it's 8 bit integer and as big as the clip.
+static inline int checkMask(const VSVideoInfo *mask, const VSVideoInfo *clip) {
+    return mask->format.colorFamily != cfUndefined
+        && mask->format.sampleType == stInteger
+        && mask->format.bitsPerSample == 8
+        && mask->width == clip->width
+        && mask->height == clip->height;
+}
+
+// A comparison clip must be laid out exactly like the clip.
+static inline int checkCompare(const VSVideoInfo *compare, const VSVideoInfo *clip) {
+    return compare->format.colorFamily == clip->format.colorFamily
+        && compare->format.sampleType == clip->format.sampleType
+        && compare->format.bitsPerSample == clip->format.bitsPerSample
+        && compare->format.subSamplingW == clip->format.subSamplingW
+        && compare->format.subSamplingH == clip->format.subSamplingH
+        && compare->width == clip->width
+        && compare->height == clip->height;
+}
+
+// From _FieldBased. Frames without it, or marked progressive, are treated
+// as top field first.
+static inline int isTopFieldFirst(const VSFrame *frame, const VSAPI *vsapi) {
+    int err;
+    return vsapi->mapGetInt(vsapi->getFramePropertiesRO(frame), "_FieldBased", 0, &err) != 1;
+}
+
 #endif
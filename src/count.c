@@ -0,0 +1,390 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "common.h"
+#include "count.h"
+
+
+static void countPlaneUnmasked(int hist[256], const uint8_t *srcp, int src_stride, int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH, const FloatBins *bins) {
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            hist[srcp[y * src_stride + x]]++;
+        }
+    }
+}
+
+
+// The lines are taken two at a time, so each field's histogram is known
+// without checking which line it is.
+static void countPlaneUnmaskedFields(int hist_even[256], int hist_odd[256], const uint8_t *srcp, int src_stride, int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH, const FloatBins *bins) {
+    int x, y;
+
+    for (y = 0; y + 1 < height; y += 2) {
+        const uint8_t *even = srcp + y * src_stride;
+        const uint8_t *odd = even + src_stride;
+        for (x = 0; x < width; x++) {
+            hist_even[even[x]]++;
+            hist_odd[odd[x]]++;
+        }
+    }
+
+    if (y < height) {
+        for (x = 0; x < width; x++) {
+            hist_even[srcp[y * src_stride + x]]++;
+        }
+    }
+}
+
+
+#define COUNT_ROW_MASKED(hist, row, maskrow, SUBW) \
+    for (x = 0; x < width; x++) { \
+        if ((maskrow)[x << (SUBW)]) \
+            (hist)[(row)[x]]++; \
+    }
+
+#define COUNT_PLANE_MASKED(name, SUBW, SUBH) \
+static void name(int hist[256], const uint8_t *srcp, int src_stride, int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH, const FloatBins *bins) { \
+    int x, y; \
+    \
+    for (y = 0; y < height; y++) { \
+        const uint8_t *maskrow = maskp + (y << (SUBH)) * mask_stride; \
+        COUNT_ROW_MASKED(hist, srcp + y * src_stride, maskrow, SUBW) \
+    } \
+} \
+\
+static void name##Fields(int hist_even[256], int hist_odd[256], const uint8_t *srcp, int src_stride, int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH, const FloatBins *bins) { \
+    int x, y; \
+    \
+    for (y = 0; y + 1 < height; y += 2) { \
+        COUNT_ROW_MASKED(hist_even, srcp + y * src_stride, maskp + (y << (SUBH)) * mask_stride, SUBW) \
+        COUNT_ROW_MASKED(hist_odd, srcp + (y + 1) * src_stride, maskp + ((y + 1) << (SUBH)) * mask_stride, SUBW) \
+    } \
+    \
+    if (y < height) { \
+        COUNT_ROW_MASKED(hist_even, srcp + y * src_stride, maskp + (y << (SUBH)) * mask_stride, SUBW) \
+    } \
+}
+
+COUNT_PLANE_MASKED(countPlaneMaskedGeneric, subW, subH)
+COUNT_PLANE_MASKED(countPlaneMasked00, 0, 0)
+COUNT_PLANE_MASKED(countPlaneMasked01, 0, 1)
+COUNT_PLANE_MASKED(countPlaneMasked02, 0, 2)
+COUNT_PLANE_MASKED(countPlaneMasked10, 1, 0)
+COUNT_PLANE_MASKED(countPlaneMasked11, 1, 1)
+COUNT_PLANE_MASKED(countPlaneMasked12, 1, 2)
+COUNT_PLANE_MASKED(countPlaneMasked20, 2, 0)
+COUNT_PLANE_MASKED(countPlaneMasked21, 2, 1)
+COUNT_PLANE_MASKED(countPlaneMasked22, 2, 2)
+
+
+void countPlane(int hist[256], const uint8_t *srcp, int src_stride, int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH, const FloatBins *bins) {
+    (maskp ? countPlaneMaskedGeneric : countPlaneUnmasked)(hist, srcp, src_stride, width, height, maskp, mask_stride, subW, subH, bins);
+}
+
+
+int64_t countPlaneDiffGeneric(int hist[256], const uint8_t *srcp, int src_stride, const uint8_t *prevp, int prev_stride, int width, int height, int *peak) {
+    int64_t sum = 0;
+    int maxval = 0;
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t *src = srcp + y * src_stride;
+        const uint8_t *prev = prevp + y * prev_stride;
+
+        for (int x = 0; x < width; x++) {
+            const int diff = abs(src[x] - prev[x]);
+
+            hist[diff]++;
+            sum += diff;
+            maxval = MAX(maxval, diff);
+        }
+    }
+
+    *peak = maxval;
+    return sum;
+}
+
+
+#ifdef __SSE2__
+// 16 pixels at a time: the difference, its sum and its peak in SSE2, then
+// the differences are counted from a small buffer.
+int64_t countPlaneDiff(int hist[256], const uint8_t *srcp, int src_stride, const uint8_t *prevp, int prev_stride, int width, int height, int *peak) {
+    const int simd_width = width & ~15;
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sums = _mm_setzero_si128();
+    __m128i maxvals = _mm_setzero_si128();
+    int64_t sum = 0;
+    int maxval = 0;
+    uint8_t diffs[16];
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t *src = srcp + y * src_stride;
+        const uint8_t *prev = prevp + y * prev_stride;
+        int x;
+
+        for (x = 0; x < simd_width; x += 16) {
+            const __m128i a = _mm_loadu_si128((const __m128i *)(src + x));
+            const __m128i b = _mm_loadu_si128((const __m128i *)(prev + x));
+            const __m128i diff = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+
+            sums = _mm_add_epi64(sums, _mm_sad_epu8(diff, zero));
+            maxvals = _mm_max_epu8(maxvals, diff);
+
+            _mm_storeu_si128((__m128i *)diffs, diff);
+            for (int i = 0; i < 16; i++)
+                hist[diffs[i]]++;
+        }
+
+        for (; x < width; x++) {
+            const int diff = abs(src[x] - prev[x]);
+
+            hist[diff]++;
+            sum += diff;
+            maxval = MAX(maxval, diff);
+        }
+    }
+
+    int64_t halves[2];
+    _mm_storeu_si128((__m128i *)halves, sums);
+    sum += halves[0] + halves[1];
+
+    _mm_storeu_si128((__m128i *)diffs, maxvals);
+    for (int i = 0; i < 16; i++)
+        maxval = MAX(maxval, diffs[i]);
+
+    *peak = maxval;
+    return sum;
+}
+#else
+int64_t countPlaneDiff(int hist[256], const uint8_t *srcp, int src_stride, const uint8_t *prevp, int prev_stride, int width, int height, int *peak) {
+    return countPlaneDiffGeneric(hist, srcp, src_stride, prevp, prev_stride, width, height, peak);
+}
+#endif
+
+
+void countPlaneFields(int hist_even[256], int hist_odd[256], const uint8_t *srcp, int src_stride, int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH, const FloatBins *bins) {
+    (maskp ? countPlaneMaskedGenericFields : countPlaneUnmaskedFields)(hist_even, hist_odd, srcp, src_stride, width, height, maskp, mask_stride, subW, subH, bins);
+}
+
+
+CountPlaneFunc selectCountPlane(int masked, int subW, int subH) {
+    static const CountPlaneFunc masked_funcs[3][3] = {
+        { countPlaneMasked00, countPlaneMasked01, countPlaneMasked02 },
+        { countPlaneMasked10, countPlaneMasked11, countPlaneMasked12 },
+        { countPlaneMasked20, countPlaneMasked21, countPlaneMasked22 }
+    };
+
+    if (!masked)
+        return countPlaneUnmasked;
+
+    if (subW <= 2 && subH <= 2)
+        return masked_funcs[subW][subH];
+
+    return countPlaneMaskedGeneric;
+}
+
+
+CountFieldsFunc selectCountFields(int masked, int subW, int subH) {
+    static const CountFieldsFunc masked_funcs[3][3] = {
+        { countPlaneMasked00Fields, countPlaneMasked01Fields, countPlaneMasked02Fields },
+        { countPlaneMasked10Fields, countPlaneMasked11Fields, countPlaneMasked12Fields },
+        { countPlaneMasked20Fields, countPlaneMasked21Fields, countPlaneMasked22Fields }
+    };
+
+    if (!masked)
+        return countPlaneUnmaskedFields;
+
+    if (subW <= 2 && subH <= 2)
+        return masked_funcs[subW][subH];
+
+    return countPlaneMaskedGenericFields;
+}
+
+
+// PQ (SMPTE ST 2084) code value to cd/m2.
+static double pqToNits(double code) {
+    const double m1 = 2610.0 / 16384.0;
+    const double m2 = 2523.0 / 4096.0 * 128.0;
+    const double c1 = 3424.0 / 4096.0;
+    const double c2 = 2413.0 / 4096.0 * 32.0;
+    const double c3 = 2392.0 / 4096.0 * 32.0;
+
+    double p = pow(code, 1.0 / m2);
+    return 10000.0 * pow(fmax(p - c1, 0.0) / (c2 - c3 * p), 1.0 / m1);
+}
+
+
+// HLG (ARIB STD-B67) code value to scene light, 1.0 being the nominal peak.
+static double hlgToLinear(double code) {
+    const double a = 0.17883277;
+    const double b = 1.0 - 4.0 * a;
+    const double c = 0.5 - a * log(4.0 * a);
+
+    if (code <= 0.5)
+        return code * code / 3.0;
+    return (exp((code - c) / a) + b) / 12.0;
+}
+
+
+void floatBinsInit(FloatBins *bins, int transfer, double lo, double hi, double nits) {
+    bins->transfer = transfer;
+    bins->lo = (float)lo;
+    bins->scale = (float)(255.0 / (hi - lo));
+
+    for (int i = 0; i < 255; i++) {
+        // Each bin is centred on its code value.
+        const double code = (i + 0.5) / 255.0;
+
+        if (transfer == TRANSFER_PQ)
+            bins->edges[i] = (float)(pqToNits(code) / nits);
+        else if (transfer == TRANSFER_HLG)
+            bins->edges[i] = (float)(hlgToLinear(code) * 1000.0 / nits);
+        else
+            bins->edges[i] = (float)(lo + code * (hi - lo));
+    }
+}
+
+
+static inline int floatBinLinear(float value, const FloatBins *bins) {
+    const float bin = (value - bins->lo) * bins->scale + 0.5f;
+
+    // Also catches NaN.
+    if (!(bin >= 0.0f))
+        return 0;
+    return bin >= 255.0f ? 255 : (int)bin;
+}
+
+
+// Binary search, always 8 steps.
+static inline int floatBinEdges(float value, const FloatBins *bins) {
+    int bin = 0;
+    for (int step = 128; step; step >>= 1)
+        if (value >= bins->edges[bin + step - 1])
+            bin += step;
+    return bin;
+}
+
+
+// The fields are counted one after the other, each skipping every other
+// line of the plane and the mask.
+#define COUNT_FLOAT_UNMASKED(name, BIN) \
+static void name(int hist[256], const uint8_t *srcp, int src_stride, int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH, const FloatBins *bins) { \
+    int x, y; \
+    \
+    for (y = 0; y < height; y++) { \
+        const float *row = (const float *)(srcp + y * src_stride); \
+        for (x = 0; x < width; x++) { \
+            hist[BIN(row[x], bins)]++; \
+        } \
+    } \
+} \
+\
+static void name##Fields(int hist_even[256], int hist_odd[256], const uint8_t *srcp, int src_stride, int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH, const FloatBins *bins) { \
+    name(hist_even, srcp, src_stride * 2, width, (height + 1) / 2, NULL, 0, subW, subH, bins); \
+    name(hist_odd, srcp + src_stride, src_stride * 2, width, height / 2, NULL, 0, subW, subH, bins); \
+}
+
+#define COUNT_FLOAT_MASKED(name, BIN, SUBW, SUBH) \
+static void name(int hist[256], const uint8_t *srcp, int src_stride, int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH, const FloatBins *bins) { \
+    int x, y; \
+    \
+    for (y = 0; y < height; y++) { \
+        const float *row = (const float *)(srcp + y * src_stride); \
+        const uint8_t *maskrow = maskp + (y << (SUBH)) * mask_stride; \
+        for (x = 0; x < width; x++) { \
+            if (maskrow[x << (SUBW)]) \
+                hist[BIN(row[x], bins)]++; \
+        } \
+    } \
+} \
+\
+static void name##Fields(int hist_even[256], int hist_odd[256], const uint8_t *srcp, int src_stride, int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH, const FloatBins *bins) { \
+    name(hist_even, srcp, src_stride * 2, width, (height + 1) / 2, maskp, mask_stride * 2, subW, subH, bins); \
+    name(hist_odd, srcp + src_stride, src_stride * 2, width, height / 2, maskp + (mask_stride << (SUBH)), mask_stride * 2, subW, subH, bins); \
+}
+
+#define COUNT_FLOAT(prefix, BIN) \
+COUNT_FLOAT_UNMASKED(prefix, BIN) \
+COUNT_FLOAT_MASKED(prefix##MaskedGeneric, BIN, subW, subH) \
+COUNT_FLOAT_MASKED(prefix##Masked00, BIN, 0, 0) \
+COUNT_FLOAT_MASKED(prefix##Masked01, BIN, 0, 1) \
+COUNT_FLOAT_MASKED(prefix##Masked02, BIN, 0, 2) \
+COUNT_FLOAT_MASKED(prefix##Masked10, BIN, 1, 0) \
+COUNT_FLOAT_MASKED(prefix##Masked11, BIN, 1, 1) \
+COUNT_FLOAT_MASKED(prefix##Masked12, BIN, 1, 2) \
+COUNT_FLOAT_MASKED(prefix##Masked20, BIN, 2, 0) \
+COUNT_FLOAT_MASKED(prefix##Masked21, BIN, 2, 1) \
+COUNT_FLOAT_MASKED(prefix##Masked22, BIN, 2, 2)
+
+COUNT_FLOAT(countFloatLinear, floatBinLinear)
+COUNT_FLOAT(countFloatEdges, floatBinEdges)
+
+
+void countPlaneFloat(int hist[256], const uint8_t *srcp, int src_stride, int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH, const FloatBins *bins) {
+    CountPlaneFunc count;
+
+    if (bins->transfer == TRANSFER_LINEAR)
+        count = maskp ? countFloatLinearMaskedGeneric : countFloatLinear;
+    else
+        count = maskp ? countFloatEdgesMaskedGeneric : countFloatEdges;
+
+    count(hist, srcp, src_stride, width, height, maskp, mask_stride, subW, subH, bins);
+}
+
+
+CountPlaneFunc selectCountPlaneFloat(int transfer, int masked, int subW, int subH) {
+    static const CountPlaneFunc masked_funcs[2][3][3] = {
+        {
+            { countFloatLinearMasked00, countFloatLinearMasked01, countFloatLinearMasked02 },
+            { countFloatLinearMasked10, countFloatLinearMasked11, countFloatLinearMasked12 },
+            { countFloatLinearMasked20, countFloatLinearMasked21, countFloatLinearMasked22 }
+        },
+        {
+            { countFloatEdgesMasked00, countFloatEdgesMasked01, countFloatEdgesMasked02 },
+            { countFloatEdgesMasked10, countFloatEdgesMasked11, countFloatEdgesMasked12 },
+            { countFloatEdgesMasked20, countFloatEdgesMasked21, countFloatEdgesMasked22 }
+        }
+    };
+
+    // The linear bins are computed, the others searched.
+    const int edges = transfer != TRANSFER_LINEAR;
+
+    if (!masked)
+        return edges ? countFloatEdges : countFloatLinear;
+
+    if (subW <= 2 && subH <= 2)
+        return masked_funcs[edges][subW][subH];
+
+    return edges ? countFloatEdgesMaskedGeneric : countFloatLinearMaskedGeneric;
+}
+
+
+CountFieldsFunc selectCountFieldsFloat(int transfer, int masked, int subW, int subH) {
+    static const CountFieldsFunc masked_funcs[2][3][3] = {
+        {
+            { countFloatLinearMasked00Fields, countFloatLinearMasked01Fields, countFloatLinearMasked02Fields },
+            { countFloatLinearMasked10Fields, countFloatLinearMasked11Fields, countFloatLinearMasked12Fields },
+            { countFloatLinearMasked20Fields, countFloatLinearMasked21Fields, countFloatLinearMasked22Fields }
+        },
+        {
+            { countFloatEdgesMasked00Fields, countFloatEdgesMasked01Fields, countFloatEdgesMasked02Fields },
+            { countFloatEdgesMasked10Fields, countFloatEdgesMasked11Fields, countFloatEdgesMasked12Fields },
+            { countFloatEdgesMasked20Fields, countFloatEdgesMasked21Fields, countFloatEdgesMasked22Fields }
+        }
+    };
+
+    const int edges = transfer != TRANSFER_LINEAR;
+
+    if (!masked)
+        return edges ? countFloatEdgesFields : countFloatLinearFields;
+
+    if (subW <= 2 && subH <= 2)
+        return masked_funcs[edges][subW][subH];
+
+    return edges ? countFloatEdgesMaskedGenericFields : countFloatLinearMaskedGenericFields;
+}
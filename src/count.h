@@ -0,0 +1,70 @@
+#ifndef COUNT_H
+#define COUNT_H
+
+#include <stdint.h>
+
+enum Transfer {
+    TRANSFER_LINEAR,
+    TRANSFER_PQ,
+    TRANSFER_HLG
+};
+
+// How the samples of one 32 bit float plane are put in the 256 bins.
+// Linear bins split [lo, hi] evenly, so that lo goes in the first bin and hi
+// in the last. The other transfers take linear light, where 1.0 is "nits"
+// cd/m2, and put it in the bin of the corresponding PQ or HLG code value.
+// Their bins are stored as the linear value where each one starts, so the
+// curve isn't evaluated for every sample.
+typedef struct {
+    float lo;
+    float scale;
+    float edges[255]; // edges[i] is the lowest value in bin i + 1.
+    int transfer;
+} FloatBins;
+
+void floatBinsInit(FloatBins *bins, int transfer, double lo, double hi, double nits);
+
+
+// Adds the values of one 8 bit plane to hist. If maskp is not NULL, only the
+// pixels where the mask (luma sized, sampled at the top left luma position
+// of every subsampled pixel) is non-zero are counted. bins is only used by
+// the 32 bit float versions.
+typedef void (*CountPlaneFunc)(int hist[256], const uint8_t *srcp, int src_stride, int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH, const FloatBins *bins);
+
+// Works with any subsampling.
+void countPlane(int hist[256], const uint8_t *srcp, int src_stride, int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH, const FloatBins *bins);
+
+// Returns a version of countPlane specialised for the subsampling, which
+// ignores its subW and subH arguments, if there is one.
+CountPlaneFunc selectCountPlane(int masked, int subW, int subH);
+
+// Like countPlane, but the even lines go in hist_even and the odd lines
+// in hist_odd, in a single pass over the plane.
+typedef void (*CountFieldsFunc)(int hist_even[256], int hist_odd[256], const uint8_t *srcp, int src_stride, int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH, const FloatBins *bins);
+
+// Works with any subsampling.
+void countPlaneFields(int hist_even[256], int hist_odd[256], const uint8_t *srcp, int src_stride, int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH, const FloatBins *bins);
+
+// The same as selectCountPlane, for countPlaneFields.
+CountFieldsFunc selectCountFields(int masked, int subW, int subH);
+
+
+// Adds |src - prev| of every pixel of two 8 bit planes to hist, computing
+// the difference and counting it in the same pass. Returns the sum of the
+// differences, and sets *peak to the largest one. Uses SSE2 if the build
+// has it.
+int64_t countPlaneDiff(int hist[256], const uint8_t *srcp, int src_stride, const uint8_t *prevp, int prev_stride, int width, int height, int *peak);
+
+// The same, one pixel at a time.
+int64_t countPlaneDiffGeneric(int hist[256], const uint8_t *srcp, int src_stride, const uint8_t *prevp, int prev_stride, int width, int height, int *peak);
+
+
+// Like countPlane, for 32 bit float planes, with any transfer and subsampling.
+void countPlaneFloat(int hist[256], const uint8_t *srcp, int src_stride, int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH, const FloatBins *bins);
+
+// The same as selectCountPlane and selectCountFields, for 32 bit float
+// planes whose bins will be set up with this transfer.
+CountPlaneFunc selectCountPlaneFloat(int transfer, int masked, int subW, int subH);
+CountFieldsFunc selectCountFieldsFloat(int transfer, int masked, int subW, int subH);
+
+#endif
@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <string.h>
+#include <VapourSynth4.h>
+#include "VSHelper4.h"
+
+#include "bench.h"
+#include "common.h"
+#include "count.h"
+#include "levels.h"
+#include "panel.h"
+
+typedef struct {
+    VSNode *node;
+    VSVideoInfo vi;
+    double factor;
+    int size;
+
+    // Made in diffCreate.
+    LevelsDrawBarsFunc drawBars;
+    Panel panel;
+} DiffData;
+
+
+static const VSFrame *VS_CC diffGetFrame(int n, int activationReason, void *instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    DiffData *d = (DiffData *) instanceData;
+
+    // The first frame is compared with itself.
+    const int prev_n = MAX(0, n - 1);
+
+    if (activationReason == arInitial) {
+        if (prev_n != n)
+            vsapi->requestFrameFilter(prev_n, d->node, frameCtx);
+        vsapi->requestFrameFilter(n, d->node, frameCtx);
+    }
+    else if (activationReason == arAllFramesReady) {
+        const VSFrame *src = vsapi->getFrameFilter(n, d->node, frameCtx);
+        const VSFrame *prev = vsapi->getFrameFilter(prev_n, d->node, frameCtx);
+
+        const VSVideoFormat *fi = &d->vi.format;
+        int height = MAX(d->size, vsapi->getFrameHeight(src, 0));
+        int width = vsapi->getFrameWidth(src, 0) + d->size;
+
+        VSFrame *dst = vsapi->newVideoFrame(fi, width, height, src, core);
+
+        uint8_t *panelp[3];
+        int dst_stride[3];
+        int dst_height[3];
+        int src_width[3];
+        int src_height[3];
+
+        int hist[3][256] = { {0}, {0}, {0} };
+        double mean[3];
+        int64_t peak[3];
+
+        for (int plane = 0; plane < fi->numPlanes; plane++) {
+            const uint8_t *srcp = vsapi->getReadPtr(src, plane);
+            const int src_stride = vsapi->getStride(src, plane);
+            uint8_t *dstp = vsapi->getWritePtr(dst, plane);
+
+            dst_stride[plane] = vsapi->getStride(dst, plane);
+            dst_height[plane] = vsapi->getFrameHeight(dst, plane);
+            src_width[plane] = vsapi->getFrameWidth(src, plane);
+            src_height[plane] = vsapi->getFrameHeight(src, plane);
+            panelp[plane] = dstp + src_width[plane];
+
+            // Copy src to dst one line at a time.
+            for (int y = 0; y < src_height[plane]; y++)
+                memcpy(dstp + dst_stride[plane] * y, srcp + src_stride * y, src_width[plane]);
+
+            // If src was less than the panel, make the extra lines black.
+            if (src_height[plane] < dst_height[plane]) {
+                memset(dstp + src_height[plane] * dst_stride[plane],
+                    (plane == 0 || fi->colorFamily == cfRGB) ? 0 : 128,
+                    (dst_height[plane] - src_height[plane]) * dst_stride[plane]);
+            }
+
+            // No difference frame, the difference is counted as it's computed.
+            int plane_peak;
+            const int64_t sum = countPlaneDiff(hist[plane], srcp, src_stride, vsapi->getReadPtr(prev, plane), vsapi->getStride(prev, plane), src_width[plane], src_height[plane], &plane_peak);
+
+            mean[plane] = (double)sum / (src_width[plane] * src_height[plane]);
+            peak[plane] = plane_peak;
+        }
+
+        VSMap *props = vsapi->getFramePropertiesRW(dst);
+        vsapi->mapSetFloatArray(props, "diff_mean", mean, fi->numPlanes);
+        vsapi->mapSetIntArray(props, "diff_peak", peak, fi->numPlanes);
+
+        panelBlit(&d->panel, panelp, dst_stride, dst_height);
+        d->drawBars(panelp, dst_stride, src_width, src_height, hist, NULL, 0, d->factor, fi, d->panel.zoom, NULL);
+
+        vsapi->freeFrame(src);
+        vsapi->freeFrame(prev);
+
+        return dst;
+    }
+
+    return 0;
+}
+
+
+static void VS_CC diffFree(void *instanceData, VSCore *core, const VSAPI *vsapi) {
+    DiffData *d = (DiffData *)instanceData;
+    vsapi->freeNode(d->node);
+    panelFree(&d->panel);
+    free(d);
+}
+
+
+void VS_CC diffCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
+    DiffData d;
+    DiffData *data;
+    int err;
+
+    d.node = vsapi->mapGetNode(in, "clip", 0, 0);
+    d.vi = *vsapi->getVideoInfo(d.node);
+
+    if (!vsh_isConstantVideoFormat(&d.vi) || d.vi.format.sampleType != stInteger || d.vi.format.bitsPerSample != 8) {
+        vsapi->mapSetError(out, "Diff: only constant format 8bit integer input supported");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    d.factor = vsapi->mapGetFloat(in, "factor", 0, &err);
+    if (err)
+        d.factor = 100.0;
+
+    if (d.factor < 0.0 || d.factor > 100.0) {
+        vsapi->mapSetError(out, "Diff: factor must be between 0 and 100 (inclusive)");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    d.size = vsapi->mapGetIntSaturated(in, "size", 0, &err);
+    if (err)
+        d.size = 256;
+
+    if (d.size != 128 && d.size != 256 && d.size != 512) {
+        vsapi->mapSetError(out, "Diff: size must be 128, 256 or 512");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    d.drawBars = levelsPanelInit(&d.panel, &d.vi.format, d.size, NULL, core, vsapi);
+
+    d.vi.width += d.size;
+    d.vi.height = MAX(d.size, d.vi.height);
+
+    data = (DiffData *)malloc(sizeof(d));
+    *data = d;
+
+    VSFilterDependency deps[] = { {d.node, rpGeneral} };
+    vsapi->createVideoFilter(out, "Diff", &d.vi, diffGetFrame, diffFree, fmParallel, deps, 1, data, core);
+}
+
+
+// Every line against the one below it, as the previous frame.
+static void benchDiffWith(const BenchFrame *f, int generic) {
+    for (int plane = 0; plane < f->fi->numPlanes; plane++) {
+        int hist[256] = { 0 };
+        int peak;
+
+        (generic ? countPlaneDiffGeneric : countPlaneDiff)(hist, f->srcp[plane], f->src_stride[plane], f->srcp[plane] + f->src_stride[plane], f->src_stride[plane], f->width[plane], f->height[plane] - 1, &peak);
+    }
+}
+
+
+static void benchDiff(const BenchFrame *f, const void *data) {
+    benchDiffWith(f, 0);
+}
+
+
+static void benchDiffGeneric(const BenchFrame *f, const void *data) {
+    benchDiffWith(f, 1);
+}
+
+
+int diffBenchKernels(const VSVideoFormat *fi, BenchKernel kernels[BENCH_MAX_KERNELS], void **data) {
+    if (fi->sampleType != stInteger || fi->bitsPerSample != 8)
+        return 0;
+
+    kernels[0] = (BenchKernel){ "diff", benchDiff };
+    kernels[1] = (BenchKernel){ "diff_generic", benchDiffGeneric };
+    return 2;
+}
@@ -0,0 +1,405 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#include <time.h>
+#endif
+
+#include "export.h"
+#include "histindex.h"
+
+// Must be a power of 2.
+#define QUEUE_SIZE 1024
+
+// More frame threads than this allocate their scratch every time.
+#define SCRATCH_SLOTS 64
+
+
+typedef struct {
+    int n;
+    uint32_t size;
+    uint8_t payload[];
+} Record;
+
+typedef struct {
+    atomic_size_t seq;
+    Record *record;
+} Cell;
+
+struct HistExport {
+    FILE *file;
+    int format;
+    int kind;
+    int num_planes;
+    int num_frames;
+
+    // Only touched by the writer thread.
+    uint64_t *index;
+    uint64_t offset;
+    int failed;
+
+    // Bounded multi-producer, single consumer queue. Each cell's sequence
+    // number says whether it's free for the producer at that position or
+    // holds a record for the consumer.
+    Cell cells[QUEUE_SIZE];
+    atomic_size_t tail;
+    size_t head;
+
+    atomic_int closing;
+    pthread_t thread;
+
+    // HistUVScratch not currently lent out, NULL in empty slots.
+    _Atomic(HistUVScratch *) scratch[SCRATCH_SLOTS];
+};
+
+
+static void sleepBriefly(void) {
+#ifdef _WIN32
+    Sleep(1);
+#else
+    struct timespec ts = { 0, 1000000 };
+    nanosleep(&ts, NULL);
+#endif
+}
+
+
+static void yieldBriefly(void) {
+#ifdef _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+
+static int enqueue(HistExport *e, Record *r) {
+    size_t pos = atomic_load_explicit(&e->tail, memory_order_relaxed);
+
+    for (;;) {
+        Cell *cell = &e->cells[pos & (QUEUE_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&e->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                cell->record = r;
+                atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                return 1;
+            }
+        }
+        else if (dif < 0) {
+            // Full.
+            return 0;
+        }
+        else {
+            pos = atomic_load_explicit(&e->tail, memory_order_relaxed);
+        }
+    }
+}
+
+
+static Record *dequeue(HistExport *e) {
+    Cell *cell = &e->cells[e->head & (QUEUE_SIZE - 1)];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+
+    if (seq != e->head + 1)
+        return NULL;
+
+    Record *r = cell->record;
+    atomic_store_explicit(&cell->seq, e->head + QUEUE_SIZE, memory_order_release);
+    e->head++;
+
+    return r;
+}
+
+
+static void writeRecord(HistExport *e, const Record *r) {
+    if (e->failed)
+        return;
+
+    if (e->format == EXPORT_CSV && e->kind == HIST_KIND_UV) {
+        uint32_t num_cells;
+        memcpy(&num_cells, r->payload, sizeof(num_cells));
+        const HistUVCell *cells = (const HistUVCell *)(r->payload + sizeof(num_cells));
+
+        for (uint32_t i = 0; i < num_cells; i++)
+            fprintf(e->file, "%d,%d,%d,%u,%d\n", r->n, cells[i].u, cells[i].v, cells[i].count, cells[i].luma);
+    }
+    else if (e->format == EXPORT_CSV) {
+        const uint32_t *counts = (const uint32_t *)r->payload;
+
+        for (int plane = 0; plane < e->num_planes; plane++) {
+            fprintf(e->file, "%d,%d", r->n, plane);
+            for (int i = 0; i < 256; i++)
+                fprintf(e->file, ",%u", counts[plane * 256 + i]);
+            fputc('\n', e->file);
+        }
+    }
+    else {
+        int32_t n = r->n;
+
+        if (fwrite(&n, sizeof(n), 1, e->file) != 1
+            || fwrite(&r->size, sizeof(r->size), 1, e->file) != 1
+            || fwrite(r->payload, 1, r->size, e->file) != r->size) {
+            e->failed = 1;
+            return;
+        }
+
+        if (r->n >= 0 && r->n < e->num_frames)
+            e->index[r->n] = e->offset;
+        e->offset += sizeof(n) + sizeof(r->size) + r->size;
+    }
+
+    if (ferror(e->file))
+        e->failed = 1;
+}
+
+
+static void *writerThread(void *arg) {
+    HistExport *e = (HistExport *)arg;
+
+    for (;;) {
+        Record *r = dequeue(e);
+
+        if (r) {
+            writeRecord(e, r);
+            free(r);
+        }
+        else if (atomic_load(&e->closing)) {
+            // The producers are gone by now, so the queue really is empty.
+            break;
+        }
+        else {
+            sleepBriefly();
+        }
+    }
+
+    return NULL;
+}
+
+
+static int compareCellOrder(const void *a, const void *b) {
+    const HistCellOrder *ca = (const HistCellOrder *)a;
+    const HistCellOrder *cb = (const HistCellOrder *)b;
+
+    return (ca->last > cb->last) - (ca->last < cb->last);
+}
+
+
+HistExport *histExportOpen(const char *path, int format, int kind, const VSVideoInfo *vi, const HistSettings *settings, char *err, size_t err_size) {
+    HistExport *e = (HistExport *)calloc(1, sizeof(HistExport));
+
+    e->format = format;
+    e->kind = kind;
+    e->num_planes = vi->format.numPlanes;
+    e->num_frames = vi->numFrames;
+
+    e->file = fopen(path, format == EXPORT_CSV ? "w" : "wb");
+    if (!e->file) {
+        snprintf(err, err_size, "failed to open '%s' for writing", path);
+        free(e);
+        return NULL;
+    }
+
+    if (format == EXPORT_CSV && kind == HIST_KIND_UV) {
+        fprintf(e->file, "frame,u,v,count,luma\n");
+    }
+    else if (format == EXPORT_CSV) {
+        fprintf(e->file, "frame,plane");
+        for (int i = 0; i < 256; i++)
+            fprintf(e->file, ",%d", i);
+        fputc('\n', e->file);
+    }
+    else {
+        HistFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, HIST_FILE_MAGIC, sizeof(HIST_FILE_MAGIC));
+        header.version = HIST_FILE_VERSION;
+        header.kind = kind;
+        header.width = vi->width;
+        header.height = vi->height;
+        header.format = histFormatId(&vi->format);
+        header.num_planes = vi->format.numPlanes;
+        header.num_frames = vi->numFrames;
+        header.masked = settings->masked;
+        header.range[0] = settings->range[0];
+        header.range[1] = settings->range[1];
+        header.nits = settings->nits;
+        header.transfer = settings->transfer;
+
+        if (fwrite(&header, sizeof(header), 1, e->file) != 1) {
+            snprintf(err, err_size, "failed to write to '%s'", path);
+            fclose(e->file);
+            free(e);
+            return NULL;
+        }
+
+        e->offset = sizeof(header);
+        e->index = (uint64_t *)calloc(vi->numFrames, sizeof(uint64_t));
+    }
+
+    for (size_t i = 0; i < QUEUE_SIZE; i++)
+        atomic_init(&e->cells[i].seq, i);
+    atomic_init(&e->tail, 0);
+    atomic_init(&e->closing, 0);
+
+    if (pthread_create(&e->thread, NULL, writerThread, e)) {
+        snprintf(err, err_size, "failed to start the writer thread");
+        fclose(e->file);
+        free(e->index);
+        free(e);
+        return NULL;
+    }
+
+    return e;
+}
+
+
+void histExportPush(HistExport *e, int n, const void *payload, uint32_t size) {
+    Record *r = (Record *)malloc(sizeof(Record) + size);
+    r->n = n;
+    r->size = size;
+    memcpy(r->payload, payload, size);
+
+    while (!enqueue(e, r))
+        yieldBriefly();
+}
+
+
+void histExportPushUV(HistExport *e, int n, const int *histUV, HistUVScratch *s) {
+    uint32_t num_cells = 0;
+
+    for (int i = 0; i < 256 * 256; i++) {
+        if (!histUV[i])
+            continue;
+
+        s->order[num_cells].last = s->lastUV[i];
+        s->order[num_cells].i = i;
+        num_cells++;
+    }
+
+    qsort(s->order, num_cells, sizeof(HistCellOrder), compareCellOrder);
+
+    // Packed straight into the record, which goes to the queue as it is.
+    const uint32_t size = sizeof(num_cells) + num_cells * sizeof(HistUVCell);
+    Record *r = (Record *)malloc(sizeof(Record) + size);
+    r->n = n;
+    r->size = size;
+    memcpy(r->payload, &num_cells, sizeof(num_cells));
+
+    HistUVCell *cells = (HistUVCell *)(r->payload + sizeof(num_cells));
+
+    for (uint32_t c = 0; c < num_cells; c++) {
+        const int i = s->order[c].i;
+
+        cells[c].u = i & 255;
+        cells[c].v = i >> 8;
+        cells[c].luma = s->lumaUV[i];
+        cells[c].reserved = 0;
+        cells[c].count = histUV[i];
+    }
+
+    while (!enqueue(e, r))
+        yieldBriefly();
+}
+
+
+HistUVScratch *histExportTakeScratch(HistExport *e) {
+    for (int i = 0; i < SCRATCH_SLOTS; i++) {
+        HistUVScratch *s = atomic_exchange(&e->scratch[i], NULL);
+        if (s)
+            return s;
+    }
+
+    return (HistUVScratch *)malloc(sizeof(HistUVScratch));
+}
+
+
+void histExportReturnScratch(HistExport *e, HistUVScratch *s) {
+    for (int i = 0; i < SCRATCH_SLOTS; i++) {
+        HistUVScratch *empty = NULL;
+        if (atomic_compare_exchange_strong(&e->scratch[i], &empty, s))
+            return;
+    }
+
+    free(s);
+}
+
+
+void histExportClose(HistExport *e) {
+    if (!e)
+        return;
+
+    atomic_store(&e->closing, 1);
+    pthread_join(e->thread, NULL);
+
+    if (e->format == EXPORT_BINARY && !e->failed) {
+        // Align the index so it can be read in place from a mapping.
+        static const uint8_t padding[sizeof(uint64_t)] = { 0 };
+        size_t padding_size = (sizeof(uint64_t) - e->offset % sizeof(uint64_t)) % sizeof(uint64_t);
+        fwrite(padding, 1, padding_size, e->file);
+
+        HistFileFooter footer;
+        memset(&footer, 0, sizeof(footer));
+        footer.index_offset = e->offset + padding_size;
+        memcpy(footer.magic, HIST_FILE_END_MAGIC, sizeof(HIST_FILE_END_MAGIC));
+
+        fwrite(e->index, sizeof(uint64_t), e->num_frames, e->file);
+        fwrite(&footer, sizeof(footer), 1, e->file);
+    }
+
+    fclose(e->file);
+    for (int i = 0; i < SCRATCH_SLOTS; i++)
+        free(atomic_load(&e->scratch[i]));
+    free(e->index);
+    free(e);
+}
+
+
+int openExportAndIndex(const VSMap *in, VSMap *out, const char *filter_name, int kind, const VSVideoInfo *vi, const HistSettings *settings, HistExport **export, HistIndex **index, const VSAPI *vsapi) {
+    int err;
+    char msg[256];
+    char error[300];
+
+    *export = NULL;
+    *index = NULL;
+
+    const char *index_path = vsapi->mapGetData(in, "index", 0, &err);
+    if (!err) {
+        // A missing or mismatched file just means everything gets counted.
+        *index = histIndexOpen(index_path, kind, vi, settings);
+    }
+    else {
+        index_path = NULL;
+    }
+
+    const char *export_path = vsapi->mapGetData(in, "export", 0, &err);
+    if (err)
+        return 1;
+
+    if (index_path && !strcmp(export_path, index_path)) {
+        snprintf(error, sizeof(error), "%s: export and index must be different files", filter_name);
+        vsapi->mapSetError(out, error);
+        histIndexClose(*index);
+        *index = NULL;
+        return 0;
+    }
+
+    int csv = !!vsapi->mapGetInt(in, "csv", 0, &err);
+
+    *export = histExportOpen(export_path, csv ? EXPORT_CSV : EXPORT_BINARY, kind, vi, settings, msg, sizeof(msg));
+    if (!*export) {
+        snprintf(error, sizeof(error), "%s: %s", filter_name, msg);
+        vsapi->mapSetError(out, error);
+        histIndexClose(*index);
+        *index = NULL;
+        return 0;
+    }
+
+    return 1;
+}
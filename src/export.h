@@ -0,0 +1,129 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <VapourSynth4.h>
+
+// Binary histogram files ("sidecars") look like this, in the host's byte
+// order:
+//
+//   HistFileHeader
+//   records, in the order the frames were rendered:
+//       int32_t frame number, uint32_t payload size, payload
+//   zero padding to a multiple of 8 bytes
+//   uint64_t offset of each frame's latest record, 0 if it has none
+//   HistFileFooter
+//
+// The index and the footer are only written when the file is closed.
+
+#define HIST_FILE_MAGIC "HISTIDX"
+#define HIST_FILE_END_MAGIC "HISTEND"
+#define HIST_FILE_VERSION 1
+
+enum hist_kind {
+    // uint32_t counts[numPlanes][256]
+    HIST_KIND_LEVELS = 0,
+    // uint32_t number of cells, then that many HistUVCell,
+    // only for the (u, v) pairs that occur in the frame
+    HIST_KIND_UV
+};
+
+enum hist_export_format {
+    EXPORT_BINARY = 0,
+    EXPORT_CSV
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t kind;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format; // See histFormatId.
+    uint32_t num_planes;
+    uint32_t num_frames;
+    uint32_t masked;
+    double range[2];
+    double nits;
+    uint32_t transfer;
+    uint32_t reserved[5];
+} HistFileHeader;
+
+// What the histograms were counted with, besides the clip. A file is only
+// used as an index with the same settings. range, nits and transfer (see
+// enum Transfer in count.h) are only set by Levels for float clips, and
+// are 0 otherwise.
+typedef struct {
+    int masked;
+    double range[2];
+    double nits;
+    int transfer;
+} HistSettings;
+
+typedef struct {
+    uint64_t index_offset;
+    char magic[8];
+} HistFileFooter;
+
+// luma is the luma of the last pixel with this chroma, in raster order.
+typedef struct {
+    uint8_t u;
+    uint8_t v;
+    uint8_t luma;
+    uint8_t reserved;
+    uint32_t count;
+} HistUVCell;
+
+typedef struct HistExport HistExport;
+struct HistIndex;
+
+
+static inline uint32_t histFormatId(const VSVideoFormat *fi) {
+    return (uint32_t)fi->colorFamily << 24 | (uint32_t)fi->sampleType << 16 | (uint32_t)fi->bitsPerSample << 8 | (uint32_t)fi->subSamplingW << 4 | (uint32_t)fi->subSamplingH;
+}
+
+typedef struct {
+    int last;
+    int i;
+} HistCellOrder;
+
+// Room to count a frame's chroma histogram for export. histUV is indexed by
+// v * 256 + u, lumaUV holds the luma and lastUV the raster position of the
+// last pixel with each chroma. histUV is for callers that don't have their
+// own, order is only used by histExportPushUV.
+typedef struct {
+    int histUV[256 * 256];
+    uint8_t lumaUV[256 * 256];
+    int lastUV[256 * 256];
+    HistCellOrder order[256 * 256];
+} HistUVScratch;
+
+// Opens the file and starts the writer thread. Returns NULL and fills err on failure.
+HistExport *histExportOpen(const char *path, int format, int kind, const VSVideoInfo *vi, const HistSettings *settings, char *err, size_t err_size);
+
+// Copies the payload into the queue. Never drops a record: if the writer
+// falls far behind, the caller yields until there is room again.
+void histExportPush(HistExport *e, int n, const void *payload, uint32_t size);
+
+// Packs histUV, with the luma and positions in s, into a HIST_KIND_UV record
+// and queues it.
+// The cells are stored in the order of lastUV, so that drawing them one after
+// the other ends up like drawing every pixel.
+void histExportPushUV(HistExport *e, int n, const int *histUV, HistUVScratch *s);
+
+// Lends out a HistUVScratch kept by the export, allocating one only when all
+// of them are in use, so frames don't need their own. histUV is not cleared.
+HistUVScratch *histExportTakeScratch(HistExport *e);
+
+// Gives back a HistUVScratch from histExportTakeScratch.
+void histExportReturnScratch(HistExport *e, HistUVScratch *s);
+
+// Writes out everything still queued, then the index, and joins the writer.
+void histExportClose(HistExport *e);
+
+// Handles the "export", "csv" and "index" arguments shared by the filters.
+// Returns 0 after setting an error on out if something went wrong.
+int openExportAndIndex(const VSMap *in, VSMap *out, const char *filter_name, int kind, const VSVideoInfo *vi, const HistSettings *settings, HistExport **export, struct HistIndex **index, const VSAPI *vsapi);
+
+#endif
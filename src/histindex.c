@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "export.h"
+#include "histindex.h"
+
+
+struct HistIndex {
+    const uint8_t *data;
+    uint64_t size;
+    const uint64_t *index;
+    int num_frames;
+    int kind;
+    int num_planes;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+};
+
+
+static int mapFile(HistIndex *idx, const char *path) {
+#ifdef _WIN32
+    idx->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (idx->file == INVALID_HANDLE_VALUE)
+        return 0;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(idx->file, &size) || !size.QuadPart) {
+        CloseHandle(idx->file);
+        return 0;
+    }
+    idx->size = size.QuadPart;
+
+    idx->mapping = CreateFileMappingA(idx->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!idx->mapping) {
+        CloseHandle(idx->file);
+        return 0;
+    }
+
+    idx->data = (const uint8_t *)MapViewOfFile(idx->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!idx->data) {
+        CloseHandle(idx->mapping);
+        CloseHandle(idx->file);
+        return 0;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) || !st.st_size) {
+        close(fd);
+        return 0;
+    }
+    idx->size = st.st_size;
+
+    void *data = mmap(NULL, idx->size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+    if (data == MAP_FAILED)
+        return 0;
+
+    idx->data = (const uint8_t *)data;
+#endif
+
+    return 1;
+}
+
+
+static void unmapFile(HistIndex *idx) {
+#ifdef _WIN32
+    UnmapViewOfFile(idx->data);
+    CloseHandle(idx->mapping);
+    CloseHandle(idx->file);
+#else
+    munmap((void *)idx->data, idx->size);
+#endif
+}
+
+
+HistIndex *histIndexOpen(const char *path, int kind, const VSVideoInfo *vi, const HistSettings *settings) {
+    HistIndex *idx = (HistIndex *)calloc(1, sizeof(HistIndex));
+
+    if (!mapFile(idx, path)) {
+        free(idx);
+        return NULL;
+    }
+
+    HistFileHeader header;
+    HistFileFooter footer;
+
+    if (idx->size < sizeof(header) + sizeof(footer))
+        goto mismatch;
+
+    memcpy(&header, idx->data, sizeof(header));
+    memcpy(&footer, idx->data + idx->size - sizeof(footer), sizeof(footer));
+
+    if (memcmp(header.magic, HIST_FILE_MAGIC, sizeof(HIST_FILE_MAGIC))
+        || memcmp(footer.magic, HIST_FILE_END_MAGIC, sizeof(HIST_FILE_END_MAGIC))
+        || header.version != HIST_FILE_VERSION
+        || header.kind != (uint32_t)kind
+        || header.width != (uint32_t)vi->width
+        || header.height != (uint32_t)vi->height
+        || header.format != histFormatId(&vi->format)
+        || header.num_planes != (uint32_t)vi->format.numPlanes
+        || header.num_frames != (uint32_t)vi->numFrames
+        || header.masked != (uint32_t)settings->masked
+        || header.range[0] != settings->range[0]
+        || header.range[1] != settings->range[1]
+        || header.nits != settings->nits
+        || header.transfer != (uint32_t)settings->transfer)
+        goto mismatch;
+
+    if (footer.index_offset % sizeof(uint64_t)
+        || footer.index_offset + header.num_frames * sizeof(uint64_t) + sizeof(footer) != idx->size)
+        goto mismatch;
+
+    idx->index = (const uint64_t *)(idx->data + footer.index_offset);
+    idx->num_frames = header.num_frames;
+    idx->kind = kind;
+    idx->num_planes = header.num_planes;
+
+    return idx;
+
+mismatch:
+    unmapFile(idx);
+    free(idx);
+    return NULL;
+}
+
+
+const uint8_t *histIndexGet(const HistIndex *idx, int n, uint32_t *size) {
+    if (n < 0 || n >= idx->num_frames)
+        return NULL;
+
+    uint64_t offset = idx->index[n];
+    int32_t record_n;
+
+    if (!offset || offset + sizeof(record_n) + sizeof(*size) > idx->size)
+        return NULL;
+
+    memcpy(&record_n, idx->data + offset, sizeof(record_n));
+    memcpy(size, idx->data + offset + sizeof(record_n), sizeof(*size));
+
+    if (record_n != n || offset + sizeof(record_n) + sizeof(*size) + *size > idx->size)
+        return NULL;
+
+    const uint8_t *payload = idx->data + offset + sizeof(record_n) + sizeof(*size);
+
+    if (idx->kind == HIST_KIND_LEVELS)
+        return *size == idx->num_planes * 256 * sizeof(uint32_t) ? payload : NULL;
+
+    uint32_t num_cells;
+    if (*size < sizeof(num_cells))
+        return NULL;
+    memcpy(&num_cells, payload, sizeof(num_cells));
+
+    return *size == sizeof(num_cells) + (uint64_t)num_cells * sizeof(HistUVCell) ? payload : NULL;
+}
+
+
+void histIndexClose(HistIndex *idx) {
+    if (!idx)
+        return;
+
+    unmapFile(idx);
+    free(idx);
+}
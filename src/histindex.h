@@ -0,0 +1,25 @@
+#ifndef HISTINDEX_H
+#define HISTINDEX_H
+
+#include <stdint.h>
+#include <VapourSynth4.h>
+
+#include "export.h"
+
+// Read-only, memory mapped view of a binary file written by histExport.
+
+typedef struct HistIndex HistIndex;
+
+
+// Returns NULL if the file doesn't exist, is incomplete, or was not made
+// from a clip with the same kind, dimensions, format and length as vi, or
+// with other settings.
+HistIndex *histIndexOpen(const char *path, int kind, const VSVideoInfo *vi, const HistSettings *settings);
+
+// Returns the payload of frame n, or NULL if the file has no record of it
+// or the record's size doesn't fit its kind.
+const uint8_t *histIndexGet(const HistIndex *idx, int n, uint32_t *size);
+
+void histIndexClose(HistIndex *idx);
+
+#endif
@@ -5,13 +5,23 @@ void VS_CC levelsCreate(const VSMap *in, VSMap *out, void *userData, VSCore *cor
 void VS_CC colorCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi);
 void VS_CC color2Create(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi);
 void VS_CC lumaCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi);
+void VS_CC analyzeCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi);
+void VS_CC timelineCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi);
+void VS_CC tilesCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi);
+void VS_CC diffCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi);
+void VS_CC benchCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi);
 
 
 VS_EXTERNAL_API(void) VapourSynthPluginInit2(VSPlugin* plugin, const VSPLUGINAPI* vspapi) {
     vspapi->configPlugin("com.nodame.histogram", "hist", "VapourSynth Histogram Plugin", VS_MAKE_VERSION(1, 0), VAPOURSYNTH_API_VERSION, 1, plugin);
-    vspapi->registerFunction("Classic", "clip:vnode;", "clip:vnode;", classicCreate, NULL, plugin);
-    vspapi->registerFunction("Levels", "clip:vnode;factor:float:opt;", "clip:vnode;", levelsCreate, NULL, plugin);
-    vspapi->registerFunction("Color", "clip:vnode;", "clip:vnode;", colorCreate, NULL, plugin);
-    vspapi->registerFunction("Color2", "clip:vnode;", "clip:vnode;", color2Create, NULL, plugin);
-    vspapi->registerFunction("Luma", "clip:vnode;", "clip:vnode;", lumaCreate, NULL, plugin);
+    vspapi->registerFunction("Classic", "clip:vnode;fields:int:opt;illegal:int:opt;", "clip:vnode;", classicCreate, NULL, plugin);
+    vspapi->registerFunction("Levels", "clip:vnode;factor:float:opt;mask:vnode:opt;compare:vnode:opt;diff:int:opt;fields:int:opt;illegal:int:opt;size:int:opt;export:data:opt;csv:int:opt;index:data:opt;range:float[]:opt;transfer:data:opt;nits:float:opt;publish:data:opt;publish_slots:int:opt;", "clip:vnode;", levelsCreate, NULL, plugin);
+    vspapi->registerFunction("Color", "clip:vnode;mask:vnode:opt;compare:vnode:opt;diff:int:opt;size:int:opt;export:data:opt;csv:int:opt;index:data:opt;", "clip:vnode;", colorCreate, NULL, plugin);
+    vspapi->registerFunction("Color2", "clip:vnode;mask:vnode:opt;size:int:opt;polar:int:opt;graticule:int:opt;export:data:opt;csv:int:opt;index:data:opt;", "clip:vnode;", color2Create, NULL, plugin);
+    vspapi->registerFunction("Luma", "clip:vnode;range:float[]:opt;", "clip:vnode;", lumaCreate, NULL, plugin);
+    vspapi->registerFunction("Analyze", "clip:vnode;first:int:opt;last:int:opt;window:int:opt;file:data:opt;", "frames:int;hist0:int[];hist1:int[]:opt;hist2:int[]:opt;min:int[];max:int[];mean:float[];", analyzeCreate, NULL, plugin);
+    vspapi->registerFunction("Timeline", "clip:vnode;length:int:opt;factor:float:opt;", "clip:vnode;", timelineCreate, NULL, plugin);
+    vspapi->registerFunction("Tiles", "clip:vnode;columns:int:opt;rows:int:opt;panel:int:opt;size:int:opt;", "clip:vnode;", tilesCreate, NULL, plugin);
+    vspapi->registerFunction("Diff", "clip:vnode;factor:float:opt;size:int:opt;", "clip:vnode;", diffCreate, NULL, plugin);
+    vspapi->registerFunction("Bench", "clip:vnode;mode:data;iterations:int:opt;", "clip:vnode;", benchCreate, NULL, plugin);
 }
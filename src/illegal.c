@@ -0,0 +1,145 @@
+#include <stddef.h>
+
+#include "illegal.h"
+
+
+#define ILLEGAL_LUMA(name, MASKED) \
+static int name(int hist[256], const uint8_t *srcp, int src_stride, uint8_t *dstp, int dst_stride, int width, int height, const uint8_t *maskp, int mask_stride) { \
+    int illegal = 0; \
+    \
+    for (int y = 0; y < height; y++) { \
+        const uint8_t *src = srcp + y * src_stride; \
+        uint8_t *dst = dstp + y * dst_stride; \
+        const uint8_t *maskrow = (MASKED) ? maskp + y * mask_stride : NULL; \
+        \
+        for (int x = 0; x < width; x++) { \
+            const int value = src[x]; \
+            \
+            dst[x] = value; \
+            if ((MASKED) && !maskrow[x]) \
+                continue; \
+            \
+            hist[value]++; \
+            if (value < 16 || value > 235) { \
+                dst[x] = ILLEGAL_RED_Y; \
+                illegal++; \
+            } \
+        } \
+    } \
+    \
+    return illegal; \
+}
+
+ILLEGAL_LUMA(illegalLuma8, 0)
+ILLEGAL_LUMA(illegalLuma8Masked, 1)
+
+
+IllegalLumaFunc selectIllegalLuma8(int masked) {
+    return masked ? illegalLuma8Masked : illegalLuma8;
+}
+
+
+// One version per pixel type, bit depth and subsampling, so the shifts are
+// constants, and per use, so the histograms and the mask are only looked
+// at by the versions that need them. The Generic version of each takes
+// the subsampling from its arguments.
+#define ILLEGAL_CHROMA(name, pixel_t, BITS, SUBW, SUBH, COUNTED, MASKED) \
+static int name(int hist_u[256], int hist_v[256], const uint8_t *srcp[3], const int src_stride[3], uint8_t *dstp[3], const int dst_stride[3], int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH) { \
+    int illegal = 0; \
+    \
+    for (int y = 0; y < height; y++) { \
+        const pixel_t *srcY = (const pixel_t *)(srcp[0] + (y << (SUBH)) * src_stride[0]); \
+        const pixel_t *srcU = (const pixel_t *)(srcp[1] + y * src_stride[1]); \
+        const pixel_t *srcV = (const pixel_t *)(srcp[2] + y * src_stride[2]); \
+        pixel_t *dstU = (pixel_t *)(dstp[1] + y * dst_stride[1]); \
+        pixel_t *dstV = (pixel_t *)(dstp[2] + y * dst_stride[2]); \
+        const uint8_t *maskrow = (MASKED) ? maskp + (y << (SUBH)) * mask_stride : NULL; \
+        \
+        for (int x = 0; x < width; x++) { \
+            const int u = srcU[x]; \
+            const int v = srcV[x]; \
+            const int luma = srcY[x << (SUBW)]; \
+            \
+            dstU[x] = u; \
+            dstV[x] = v; \
+            if ((MASKED) && !maskrow[x << (SUBW)]) \
+                continue; \
+            \
+            if (COUNTED) { \
+                hist_u[u]++; \
+                hist_v[v]++; \
+            } \
+            \
+            if (u < (16 << ((BITS) - 8)) || u > (240 << ((BITS) - 8)) || v < (16 << ((BITS) - 8)) || v > (240 << ((BITS) - 8))) { \
+                dstU[x] = ILLEGAL_GREEN_U << ((BITS) - 8); \
+                dstV[x] = ILLEGAL_GREEN_V << ((BITS) - 8); \
+                illegal++; \
+            } \
+            else if (luma < (16 << ((BITS) - 8)) || luma > (235 << ((BITS) - 8))) { \
+                dstU[x] = ILLEGAL_RED_U << ((BITS) - 8); \
+                dstV[x] = ILLEGAL_RED_V << ((BITS) - 8); \
+            } \
+        } \
+    } \
+    \
+    return illegal; \
+}
+
+// Every subsampling up to 2, then the Generic version.
+#define ILLEGAL_CHROMA_SUBS(name, pixel_t, BITS, COUNTED, MASKED) \
+ILLEGAL_CHROMA(name##00, pixel_t, BITS, 0, 0, COUNTED, MASKED) \
+ILLEGAL_CHROMA(name##01, pixel_t, BITS, 0, 1, COUNTED, MASKED) \
+ILLEGAL_CHROMA(name##02, pixel_t, BITS, 0, 2, COUNTED, MASKED) \
+ILLEGAL_CHROMA(name##10, pixel_t, BITS, 1, 0, COUNTED, MASKED) \
+ILLEGAL_CHROMA(name##11, pixel_t, BITS, 1, 1, COUNTED, MASKED) \
+ILLEGAL_CHROMA(name##12, pixel_t, BITS, 1, 2, COUNTED, MASKED) \
+ILLEGAL_CHROMA(name##20, pixel_t, BITS, 2, 0, COUNTED, MASKED) \
+ILLEGAL_CHROMA(name##21, pixel_t, BITS, 2, 1, COUNTED, MASKED) \
+ILLEGAL_CHROMA(name##22, pixel_t, BITS, 2, 2, COUNTED, MASKED) \
+ILLEGAL_CHROMA(name##Generic, pixel_t, BITS, subW, subH, COUNTED, MASKED) \
+\
+static const IllegalChromaFunc name##Funcs[10] = { \
+    name##00, name##01, name##02, \
+    name##10, name##11, name##12, \
+    name##20, name##21, name##22, \
+    name##Generic \
+};
+
+ILLEGAL_CHROMA_SUBS(illegalChroma8Counted, uint8_t, 8, 1, 0)
+ILLEGAL_CHROMA_SUBS(illegalChroma8Masked, uint8_t, 8, 1, 1)
+
+ILLEGAL_CHROMA_SUBS(illegalChroma8, uint8_t, 8, 0, 0)
+ILLEGAL_CHROMA_SUBS(illegalChroma9, uint16_t, 9, 0, 0)
+ILLEGAL_CHROMA_SUBS(illegalChroma10, uint16_t, 10, 0, 0)
+ILLEGAL_CHROMA_SUBS(illegalChroma11, uint16_t, 11, 0, 0)
+ILLEGAL_CHROMA_SUBS(illegalChroma12, uint16_t, 12, 0, 0)
+ILLEGAL_CHROMA_SUBS(illegalChroma13, uint16_t, 13, 0, 0)
+ILLEGAL_CHROMA_SUBS(illegalChroma14, uint16_t, 14, 0, 0)
+ILLEGAL_CHROMA_SUBS(illegalChroma15, uint16_t, 15, 0, 0)
+ILLEGAL_CHROMA_SUBS(illegalChroma16, uint16_t, 16, 0, 0)
+
+
+// Where the version for the subsampling is in a name##Funcs table.
+static int subsamplingIndex(int subW, int subH) {
+    if (subW <= 2 && subH <= 2)
+        return subW * 3 + subH;
+
+    return 9;
+}
+
+
+IllegalChromaFunc selectIllegalChroma8(int masked, int subW, int subH) {
+    const IllegalChromaFunc *funcs = masked ? illegalChroma8MaskedFuncs : illegalChroma8CountedFuncs;
+
+    return funcs[subsamplingIndex(subW, subH)];
+}
+
+
+IllegalChromaFunc selectIllegalChroma(int bits, int subW, int subH) {
+    static const IllegalChromaFunc *funcs[9] = {
+        illegalChroma8Funcs, illegalChroma9Funcs, illegalChroma10Funcs, illegalChroma11Funcs, illegalChroma12Funcs,
+        illegalChroma13Funcs, illegalChroma14Funcs, illegalChroma15Funcs, illegalChroma16Funcs
+    };
+
+    return funcs[bits - 8][subsamplingIndex(subW, subH)];
+}
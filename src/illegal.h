@@ -0,0 +1,41 @@
+#ifndef ILLEGAL_H
+#define ILLEGAL_H
+
+#include <stdint.h>
+
+// The false colour overlay of Levels and Classic. Luma outside 16-235 is
+// painted red, chroma outside 16-240 green (both scaled to the bit depth).
+// The chroma of a luma pixel is the chroma sample whose top left luma
+// position it is, so a subsampled red pixel only turns red if the pixel in
+// that position is the illegal one.
+//
+// The functions copy the planes from src to dst, painting as they go, and
+// return how many pixels (or chroma samples) were illegal. The versions
+// that count also fill the histograms in the same pass, with the pixels
+// where the mask, if any, is non-zero (illegal pixels outside the mask are
+// neither painted nor counted).
+
+#define ILLEGAL_RED_Y 81
+#define ILLEGAL_RED_U 90
+#define ILLEGAL_RED_V 240
+#define ILLEGAL_GREEN_U 54
+#define ILLEGAL_GREEN_V 34
+
+// The luma is copied from src to dst, the chroma from srcp[1] and srcp[2]
+// to dstp[1] and dstp[2], with the luma read from srcp[0]. Each function is
+// specialised for a bit depth and, for the chroma, a subsampling, and
+// ignores its subW and subH arguments unless the subsampling has no
+// version of its own. The masked versions always use maskp, the others
+// never do.
+typedef int (*IllegalLumaFunc)(int hist[256], const uint8_t *srcp, int src_stride, uint8_t *dstp, int dst_stride, int width, int height, const uint8_t *maskp, int mask_stride);
+
+typedef int (*IllegalChromaFunc)(int hist_u[256], int hist_v[256], const uint8_t *srcp[3], const int src_stride[3], uint8_t *dstp[3], const int dst_stride[3], int width, int height, const uint8_t *maskp, int mask_stride, int subW, int subH);
+
+// For 8 bit clips, filling the histograms.
+IllegalLumaFunc selectIllegalLuma8(int masked);
+IllegalChromaFunc selectIllegalChroma8(int masked, int subW, int subH);
+
+// For 8 to 16 bit clips, only painting: no histograms, no mask.
+IllegalChromaFunc selectIllegalChroma(int bits, int subW, int subH);
+
+#endif
@@ -1,34 +1,110 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <VapourSynth4.h>
 #include <VSHelper4.h>
 
+#include "bench.h"
 #include "common.h"
+#include "count.h"
+#include "export.h"
+#include "histindex.h"
+#include "illegal.h"
+#include "levels.h"
+#include "panel.h"
+#include "publish.h"
 
 typedef struct {
     VSNode *node;
+    VSNode *mask;
+    VSNode *compare;
     VSVideoInfo vi;
     double factor;
+    int size;
+    int diff;
+    int fields;
+    int illegal;
+    HistExport *export;
+    HistIndex *index;
+    HistPublisher *publisher;
+
+    // Chosen in levelsCreate.
+    CountPlaneFunc count[3];
+    CountFieldsFunc count_fields[3];
+    IllegalLumaFunc illegal_luma;
+    IllegalChromaFunc illegal_chroma;
+    int is_float;
+    FloatBins *bins; // One per plane, for float clips.
+    float float_tab[3][256]; // 8 bit panel values to float.
+    LevelsDrawBarsFunc drawBars;
+    Panel panel;
 } LevelsData;
 
 
-static void drawYUV(uint8_t *dstp[3], const int src_width[3], const int src_height[3], const int dst_height[3], const int dst_stride[3], int hist[3][256], double factor, const VSVideoFormat *fi) {
+// Clamps hist (and hist2) and returns the value that maps to the full 64 px height.
+static int clampHist(int hist[256], int *hist2, int clampval) {
+    int maxval = 0;
+
+    for (int i = 0; i < 256; i++) {
+        if (hist[i] > clampval) {
+            hist[i] = clampval;
+        }
+        maxval = MAX(hist[i], maxval);
+
+        if (hist2) {
+            if (hist2[i] > clampval) {
+                hist2[i] = clampval;
+            }
+            maxval = MAX(hist2[i], maxval);
+        }
+    }
+
+    return maxval;
+}
+
+
+// Clamps hist (and hist2) like clampHist, and adds every step bins up into
+// one bar, for panels less than 256 px wide. Returns the value that maps to
+// the full height of the graph.
+static int binBars(int bars[256], int bars2[256], int hist[256], int *hist2, int clampval, int step) {
+    int maxval = 0;
+
+    clampHist(hist, hist2, clampval);
+
+    for (int b = 0; b < 256 / step; b++) {
+        bars[b] = 0;
+        bars2[b] = 0;
+
+        for (int i = 0; i < step; i++) {
+            bars[b] += hist[b * step + i];
+            if (hist2)
+                bars2[b] += hist2[b * step + i];
+        }
+
+        maxval = MAX(maxval, MAX(bars[b], bars2[b]));
+    }
+
+    return maxval;
+}
+
+
+static void drawYUVBackground(uint8_t *dstp[3], const int dst_stride[3], const int dst_height[3], const VSVideoFormat *fi) {
     int x, y;
 
     // Start drawing.
 
     // Clear the luma.
     for (y = 0; y < dst_height[Y]; y++) {
-        memset(dstp[Y] + y * dst_stride[Y] + src_width[Y], 0, 256);
+        memset(dstp[Y] + y * dst_stride[Y], 0, 256);
     }
 
     // Draw the background of the unsafe zones (0-15, 236-255) in the luma graph.
     for (y = 0; y <= 64; y++) {
         for (x = 0; x < 16; x++) {
-            dstp[Y][src_width[Y] + y * dst_stride[Y] + x] = 32;
+            dstp[Y][y * dst_stride[Y] + x] = 32;
         }
         for (x = 236; x < 256; x++) {
-            dstp[Y][src_width[Y] + y * dst_stride[Y] + x] = 32;
+            dstp[Y][y * dst_stride[Y] + x] = 32;
         }
     }
 
@@ -39,16 +115,16 @@ static void drawYUV(uint8_t *dstp[3], const int src_width[3], const int src_heig
         // I wonder if it would be faster to do this shit for one line
         // and just copy it 63 times.
         for (x = 0; x < 15; x++) {
-            dstp[Y][src_width[Y] + y * dst_stride[Y] + x] = 210 / 2;
+            dstp[Y][y * dst_stride[Y] + x] = 210 / 2;
         }
         for (/*x = 15*/; x <= 128; x++) {
-            dstp[Y][src_width[Y] + y * dst_stride[Y] + x] = ((128 - x) * 15) >> 3; // *1.875 // wtf is this?
+            dstp[Y][y * dst_stride[Y] + x] = ((128 - x) * 15) >> 3; // *1.875 // wtf is this?
         }
         for (/*x = 129*/; x <= 240; x++) {
-            dstp[Y][src_width[Y] + y * dst_stride[Y] + x] = ((x - 128) * 24001) >> 16; // *0.366 // and this?
+            dstp[Y][y * dst_stride[Y] + x] = ((x - 128) * 24001) >> 16; // *0.366 // and this?
         }
         for (/*x = 241*/; x < 256; x++) {
-            dstp[Y][src_width[Y] + y * dst_stride[Y] + x] = 41 / 2;
+            dstp[Y][y * dst_stride[Y] + x] = 41 / 2;
         }
     }
 
@@ -56,201 +132,259 @@ static void drawYUV(uint8_t *dstp[3], const int src_width[3], const int src_heig
     // Original comment: // x=0-16, R=0, G=B=255; x=128, R=G=B=0; x=240-255, R=255, G=B=0
     for (y = 128 + 32; y <= 128 + 64 + 32; y++) {
         for (x = 0; x < 15; x++) {
-            dstp[Y][src_width[Y] + y * dst_stride[Y] + x] = 170 / 2;
+            dstp[Y][y * dst_stride[Y] + x] = 170 / 2;
         }
         for (/*x = 15*/; x <= 128; x++) {
-            dstp[Y][src_width[Y] + y * dst_stride[Y] + x] = ((128 - x) * 99515) >> 16; // *1.518
+            dstp[Y][y * dst_stride[Y] + x] = ((128 - x) * 99515) >> 16; // *1.518
         }
         for (/*x = 129*/; x <= 240; x++) {
-            dstp[Y][src_width[Y] + y * dst_stride[Y] + x] = ((x - 128) * 47397) >> 16; // *0.723
+            dstp[Y][y * dst_stride[Y] + x] = ((x - 128) * 47397) >> 16; // *0.723
         }
         for (/*x = 241*/; x < 256; x++) {
-            dstp[Y][src_width[Y] + y * dst_stride[Y] + x] = 81 / 2;
+            dstp[Y][y * dst_stride[Y] + x] = 81 / 2;
         }
     }
 
     // Draw dotted line in the center.
     for (y = 0; y <= 256 - 32; y++) {
         if ((y & 3) > 1) {
-            dstp[Y][src_width[Y] + y * dst_stride[Y] + 128] = 128;
-        }
-    }
-
-    // Finally draw the actual histograms, starting with the luma.
-    const int clampval = (int)((src_width[Y] * src_height[Y]) * factor / 100.0);
-    int maxval = 0;
-    for (int i = 0; i < 256; i++) {
-        if (hist[Y][i] > clampval) {
-            hist[Y][i] = clampval;
+            dstp[Y][y * dst_stride[Y] + 128] = 128;
         }
-        maxval = MAX(hist[Y][i], maxval);
-    }
-
-    float scale = 64.0f / maxval; // Why float?
-
-    for (x = 0; x < 256; x++) {
-        float scaled_h = (float)hist[Y][x] * scale;
-        int h = 64 - MIN((int)scaled_h, 64) + 1;
-
-        for (y = 64 + 1; y > h; y--) {
-            dstp[Y][src_width[Y] + y * dst_stride[Y] + x] = 235;
-        }
-        dstp[Y][src_width[Y] + h * dst_stride[Y] + x] = 16;
     }
 
     if (fi->colorFamily == cfGray)
         return;
 
-    // Draw the histogram of the U plane.
-    const int clampvalUV = (int)((src_width[U] * src_height[U]) * factor / 100.0);
-
-    maxval = 0;
-    for (int i = 0; i < 256; i++) {
-        if (hist[U][i] > clampvalUV) {
-            hist[U][i] = clampvalUV;
-        }
-        maxval = MAX(hist[U][i], maxval);
-    }
-
-    scale = 64.0f / maxval;
-
-    for (x = 0; x < 256; x++) {
-        float scaled_h = (float)hist[U][x] * scale;
-        int h = 128 + 16 - MIN((int)scaled_h, 64) + 1;
-
-        for (y = 128 + 16 + 1; y > h; y--) {
-            dstp[Y][src_width[Y] + y * dst_stride[Y] + x] = 235;
-        }
-        dstp[Y][src_width[Y] + h * dst_stride[Y] + x] = 16;
-    }
-
-    // Draw the histogram of the V plane.
-    maxval = 0;
-    for (int i = 0; i < 256; i++) {
-        if (hist[V][i] > clampvalUV) {
-            hist[V][i] = clampvalUV;
-        }
-        maxval = MAX(hist[V][i], maxval);
-    }
-
-    scale = 64.0f / maxval;
-
-    for (x = 0; x < 256; x++) {
-        float scaled_h = (float)hist[V][x] * scale;
-        int h = 192 + 32 - MIN((int)scaled_h, 64) + 1;
-
-        for (y = 192 + 32 + 1; y > h; y--) {
-            dstp[Y][src_width[Y] + y * dst_stride[Y] + x] = 235;
-        }
-        dstp[Y][src_width[Y] + h * dst_stride[Y] + x] = 16;
-    }
-
-
     // Draw the chroma.
     int subW = fi->subSamplingW;
     int subH = fi->subSamplingH;
 
     // Clear the chroma first.
     for (y = 0; y < dst_height[U]; y++) {
-        memset(dstp[U] + src_width[U] + y * dst_stride[U], 128, 256 >> subW);
-        memset(dstp[V] + src_width[V] + y * dst_stride[V], 128, 256 >> subW);
+        memset(dstp[U] + y * dst_stride[U], 128, 256 >> subW);
+        memset(dstp[V] + y * dst_stride[V], 128, 256 >> subW);
     }
 
     // Draw unsafe zones in the luma graph.
     for (y = 0; y <= (64 >> subH); y++) {
         for (x = 0; x < (16 >> subW); x++) {
-            dstp[U][src_width[U] + y * dst_stride[U] + x] = 16;
-            dstp[V][src_width[V] + y * dst_stride[V] + x] = 160;
+            dstp[U][y * dst_stride[U] + x] = 16;
+            dstp[V][y * dst_stride[V] + x] = 160;
         }
         for (x = (236 >> subW); x < (256 >> subW); x++) {
-            dstp[U][src_width[U] + y * dst_stride[U] + x] = 16;
-            dstp[V][src_width[V] + y * dst_stride[V] + x] = 160;
+            dstp[U][y * dst_stride[U] + x] = 16;
+            dstp[V][y * dst_stride[V] + x] = 160;
         }
     }
 
     // Draw unsafe zones and gradient for U graph.
     for (y = ((64 + 16) >> subH); y <= ((128 + 16) >> subH); y++) {
         for (x = 0; x < (16 >> subW); x++) {
-            dstp[U][src_width[U] + y * dst_stride[U] + x] = 16 + 112 / 2;
+            dstp[U][y * dst_stride[U] + x] = 16 + 112 / 2;
         }
         for (; x <= (240 >> subW); x++) {
-            dstp[U][src_width[U] + y * dst_stride[U] + x] = x << subW;
+            dstp[U][y * dst_stride[U] + x] = x << subW;
         }
         for (; x < (256 >> subW); x++) {
-            dstp[U][src_width[U] + y * dst_stride[U] + x] = 240 - 112 / 2;
+            dstp[U][y * dst_stride[U] + x] = 240 - 112 / 2;
         }
     }
 
     // Draw unsafe zones and gradient for V graph.
     for (y = ((128 + 32) >> subH); y <= ((128 + 64 + 32) >> subH); y++) {
         for (x = 0; x < (16 >> subW); x++) {
-            dstp[V][src_width[V] + y * dst_stride[V] + x] = 16 + 112 / 2;
+            dstp[V][y * dst_stride[V] + x] = 16 + 112 / 2;
         }
         for (; x <= (240 >> subW); x++) {
-            dstp[V][src_width[V] + y * dst_stride[V] + x] = x << subW;
+            dstp[V][y * dst_stride[V] + x] = x << subW;
         }
         for (; x < (256 >> subW); x++) {
-            dstp[V][src_width[V] + y * dst_stride[V] + x] = 240 - 112 / 2;
+            dstp[V][y * dst_stride[V] + x] = 240 - 112 / 2;
         }
     }
 }
 
 
-static void drawRGB(uint8_t *dstp[3], const int src_width[3], const int src_height[3], const int dst_height[3], const int dst_stride[3], int hist[3][256], double factor, const VSVideoFormat *fi) {
-    const int clampval = (int)((src_width[0] * src_height[0]) * factor / 100.0);
-
+static void drawRGBBackground(uint8_t *dstp[3], const int dst_stride[3], const int dst_height[3], const VSVideoFormat *fi) {
     for (int plane = 0; plane < 3; plane++) {
         for (int y = (64 + 16) * plane; y < (64 + 16) * plane + 64; y++) {
             // Draw this channel's gradient.
             for (int x = 0; x < 256; x++)
-                dstp[plane][y * dst_stride[plane] + src_width[plane] + x] = x;
+                dstp[plane][y * dst_stride[plane] + x] = x;
 
             // Zero the other two channels.
             for (int i = 0; i < 3; i++)
                 if (i != plane)
-                    memset(dstp[i] + y * dst_stride[i] + src_width[i], 0, 256);
+                    memset(dstp[i] + y * dst_stride[i], 0, 256);
         }
     }
 
     for (int plane = 0; plane < 3; plane++) {
         // Zero the 16 pixels in between the histograms.
         for (int y = 64; y < 64 + 16; y++)
-            memset(dstp[plane] + y * dst_stride[plane] + src_width[plane], 0, 256);
+            memset(dstp[plane] + y * dst_stride[plane], 0, 256);
 
         for (int y = 64 + 16 + 64; y < 64 + 16 + 64 + 16; y++)
-            memset(dstp[plane] + y * dst_stride[plane] + src_width[plane], 0, 256);
+            memset(dstp[plane] + y * dst_stride[plane], 0, 256);
 
         // Draw the dotted line in the middle.
         for (int y = 0; y < 64 * 3 + 16 * 2; y++)
             if ((y & 3) > 1)
-                dstp[plane][y * dst_stride[plane] + src_width[plane] + 128] = 255;
+                dstp[plane][y * dst_stride[plane] + 128] = 255;
 
         // Zero the space below the histograms.
         for (int y = 64 * 3 + 16 * 2; y < dst_height[plane]; y++)
-            memset(dstp[plane] + y * dst_stride[plane] + src_width[plane], 0, 256);
+            memset(dstp[plane] + y * dst_stride[plane], 0, 256);
     }
+}
 
-    for (int plane = 0; plane < 3; plane++) {
-        // Draw the histogram.
-        int maxval = 0;
-        for (int i = 0; i < 256; i++) {
-            if (hist[plane][i] > clampval)
-                hist[plane][i] = clampval;
 
-            maxval = MAX(hist[plane][i], maxval);
-        }
+#define LEVELS_PUT(pixel_t, VALUE, dstp, dst_stride, x, y, v) \
+    (((pixel_t *)((dstp) + (y) * (dst_stride)))[x] = VALUE(values, v))
+
+// The bars are drawn straight into the frame, at the panel's size, as
+// pixel_t. VALUE turns the 8 bit values of the template into pixel_t, with
+// values (one plane's tab) for float clips.
+#define LEVELS_BARS(suffix, pixel_t, VALUE) \
+\
+/* Draws one graph, 64 px tall at 256, whose bottom line is "bottom" at 256. \
+   The histogram of the comparison clip, if any, is drawn as a grey trace, \
+   or, with diff, as the shaded difference between the two bars. */ \
+static void drawGraph##suffix(uint8_t *dstp, int dst_stride, int bottom, int hist[256], int *hist2, int clampval, int diff, int zoom, const float *values) { \
+    const int step = panelStep(zoom); \
+    const int height = panelPos(zoom, 64); \
+    int bars[256], bars2[256]; \
+    int y; \
+    \
+    int maxval = binBars(bars, bars2, hist, hist2, clampval, step); \
+    \
+    float scale = maxval ? (float)height / maxval : 0.0f; /* Why float? */ \
+    \
+    bottom = panelLast(zoom, bottom); \
+    \
+    for (int b = 0; b < 256 / step; b++) { \
+        float scaled_h = (float)bars[b] * scale; \
+        int h = bottom - MIN((int)scaled_h, height); \
+        float scaled_h2 = (float)bars2[b] * scale; \
+        int h2 = bottom - MIN((int)scaled_h2, height); \
+        \
+        for (int x = panelPos(zoom, b * step); x <= panelLast(zoom, b * step + step - 1); x++) { \
+            if (hist2 && diff) { \
+                /* Common part in white, the clip's excess in light grey, \
+                   the comparison clip's excess in dark grey. */ \
+                for (y = bottom; y > MAX(h, h2); y--) \
+                    LEVELS_PUT(pixel_t, VALUE, dstp, dst_stride, x, y, 235); \
+                for (; y > MIN(h, h2); y--) \
+                    LEVELS_PUT(pixel_t, VALUE, dstp, dst_stride, x, y, (h < h2) ? 160 : 80); \
+                LEVELS_PUT(pixel_t, VALUE, dstp, dst_stride, x, MIN(h, h2), 16); \
+                continue; \
+            } \
+            \
+            for (y = bottom; y > h; y--) \
+                LEVELS_PUT(pixel_t, VALUE, dstp, dst_stride, x, y, 235); \
+            LEVELS_PUT(pixel_t, VALUE, dstp, dst_stride, x, h, 16); \
+            if (hist2 && h2 < bottom) \
+                LEVELS_PUT(pixel_t, VALUE, dstp, dst_stride, x, h2, 128); \
+        } \
+    } \
+} \
+\
+static void drawYUVBars##suffix(uint8_t *dstp[3], const int dst_stride[3], const int src_width[3], const int src_height[3], int hist[3][256], int (*hist2)[256], int diff, double factor, const VSVideoFormat *fi, int zoom, const float (*tab)[256]) { \
+    /* Finally draw the actual histograms, starting with the luma. */ \
+    const int clampval = (int)((src_width[Y] * src_height[Y]) * factor / 100.0); \
+    const float *values = tab ? tab[Y] : NULL; \
+    \
+    drawGraph##suffix(dstp[Y], dst_stride[Y], 64 + 1, hist[Y], hist2 ? hist2[Y] : NULL, clampval, diff, zoom, values); \
+    \
+    if (fi->colorFamily == cfGray) \
+        return; \
+    \
+    /* Draw the histograms of the U and V planes. */ \
+    const int clampvalUV = (int)((src_width[U] * src_height[U]) * factor / 100.0); \
+    \
+    drawGraph##suffix(dstp[Y], dst_stride[Y], 128 + 16 + 1, hist[U], hist2 ? hist2[U] : NULL, clampvalUV, diff, zoom, values); \
+    drawGraph##suffix(dstp[Y], dst_stride[Y], 192 + 32 + 1, hist[V], hist2 ? hist2[V] : NULL, clampvalUV, diff, zoom, values); \
+} \
+\
+static void drawRGBBars##suffix(uint8_t *dstp[3], const int dst_stride[3], const int src_width[3], const int src_height[3], int hist[3][256], int (*hist2)[256], int diff, double factor, const VSVideoFormat *fi, int zoom, const float (*tab)[256]) { \
+    const int clampval = (int)((src_width[0] * src_height[0]) * factor / 100.0); \
+    const int step = panelStep(zoom); \
+    const int height = panelPos(zoom, 64); \
+    /* The same for every channel. */ \
+    const float *values = tab ? tab[0] : NULL; \
+    \
+    for (int plane = 0; plane < 3; plane++) { \
+        /* Draw the histogram. */ \
+        int bars[256], bars2[256]; \
+        int maxval = binBars(bars, bars2, hist[plane], hist2 ? hist2[plane] : NULL, clampval, step); \
+        \
+        float scale = maxval ? (float)height / maxval : 0.0f; /* Why float? */ \
+        const int top = panelPos(zoom, (64 + 16) * plane); \
+        \
+        for (int b = 0; b < 256 / step; b++) { \
+            float scaled_h = bars[b] * scale; \
+            int h = height - MIN((int)scaled_h, height); \
+            float scaled_h2 = bars2[b] * scale; \
+            int h2 = height - MIN((int)scaled_h2, height); \
+            \
+            for (int x = panelPos(zoom, b * step); x <= panelLast(zoom, b * step + step - 1); x++) { \
+                for (int y = top + height - 1; y >= top + h; y--) \
+                    for (int i = 0; i < 3; i++) \
+                        LEVELS_PUT(pixel_t, VALUE, dstp[i], dst_stride[i], x, y, 255); \
+                \
+                if (!hist2) \
+                    continue; \
+                \
+                if (diff) { \
+                    /* The clip's excess in light grey, the comparison clip's in dark grey. */ \
+                    for (int y = top + MAX(h, h2) - 1; y >= top + MIN(h, h2); y--) \
+                        for (int i = 0; i < 3; i++) \
+                            LEVELS_PUT(pixel_t, VALUE, dstp[i], dst_stride[i], x, y, (h < h2) ? 192 : 96); \
+                } \
+                else if (h2 < height) { \
+                    for (int i = 0; i < 3; i++) \
+                        LEVELS_PUT(pixel_t, VALUE, dstp[i], dst_stride[i], x, top + h2, 128); \
+                } \
+            } \
+        } \
+    } \
+}
 
-        float scale = 64.0f / maxval; // Why float?
+#define VALUE_8BIT(values, v) ((void)(values), (v))
+#define VALUE_FLOAT(values, v) ((values)[v])
 
-        for (int x = 0; x < 256; x++) {
-            float scaled_h = hist[plane][x] * scale;
-            int h = 64 - MIN((int)scaled_h, 64);
+LEVELS_BARS(, uint8_t, VALUE_8BIT)
+LEVELS_BARS(Float, float, VALUE_FLOAT)
 
-            for (int y = (64 + 16) * plane + 64 - 1; y >= (64 + 16) * plane + h; y--)
-                for (int i = 0; i < 3; i++)
-                    dstp[i][src_width[i] + y * dst_stride[i] + x] = 255;
-        }
+LevelsDrawBarsFunc levelsPanelInit(Panel *p, const VSVideoFormat *fi, int size, const float (*tab)[256], VSCore *core, const VSAPI *vsapi) {
+    const int isRGB = fi->colorFamily == cfRGB;
+    const uint8_t fill[3] = { 0, isRGB ? 0 : 128, isRGB ? 0 : 128 };
+
+    // Drawn in 8 bit at 256 px, then made into what the frames need.
+    VSVideoFormat panel_format;
+    vsapi->queryVideoFormat(&panel_format, fi->colorFamily, stInteger, 8, fi->subSamplingW, fi->subSamplingH, core);
+
+    panelInit(p, &panel_format, 256, 256, fill);
+
+    const int panel_height[3] = { p->height[0], p->height[1], p->height[2] };
+    (isRGB ? drawRGBBackground : drawYUVBackground)(p->data, p->width, panel_height, &panel_format);
+
+    panelScale(p, size);
+
+    if (tab) {
+        panelToFloat(p, tab);
+        return isRGB ? drawRGBBarsFloat : drawYUVBarsFloat;
     }
+
+    return isRGB ? drawRGBBars : drawYUVBars;
+}
+
+
+// Frames whose histograms come from the index don't need the mask, unless
+// the comparison clip is counted too.
+static int needsMask(const LevelsData *d, int n) {
+    uint32_t size;
+    return d->mask && (d->compare || !d->index || !histIndexGet(d->index, n, &size));
 }
 
 
@@ -259,13 +393,19 @@ static const VSFrame *VS_CC levelsGetFrame(int n, int activationReason, void *in
 
     if (activationReason == arInitial) {
         vsapi->requestFrameFilter(n, d->node, frameCtx);
+        if (needsMask(d, n))
+            vsapi->requestFrameFilter(n, d->mask, frameCtx);
+        if (d->compare)
+            vsapi->requestFrameFilter(n, d->compare, frameCtx);
     }
     else if (activationReason == arAllFramesReady) {
         const VSFrame *src = vsapi->getFrameFilter(n, d->node, frameCtx);
+        const VSFrame *mask = needsMask(d, n) ? vsapi->getFrameFilter(n, d->mask, frameCtx) : NULL;
+        const VSFrame *cmp = d->compare ? vsapi->getFrameFilter(n, d->compare, frameCtx) : NULL;
 
         const VSVideoFormat *fi = &d->vi.format;
-        int height = MAX(256, vsapi->getFrameHeight(src, 0));
-        int width = vsapi->getFrameWidth(src, 0) + 256;
+        int height = MAX(d->size, vsapi->getFrameHeight(src, 0));
+        int width = vsapi->getFrameWidth(src, 0) + d->size;
 
         VSFrame *dst = vsapi->newVideoFrame(fi, width, height, src, core);
 
@@ -280,14 +420,37 @@ static const VSFrame *VS_CC levelsGetFrame(int n, int activationReason, void *in
 
         int dst_height[3];
 
+        uint8_t *panelp[3];
+
         int y;
-        int x;
 
         int plane;
 
         // This better be the right way to get an array of 3 arrays of 256 ints each...
         // each array with its elements initialised to 0.
         int hist[3][256] = { {0}, {0}, {0} };
+        int hist2[3][256] = { {0}, {0}, {0} };
+
+        // Only the first plane of the mask is used, sampled at the
+        // top left luma position of every chroma sample.
+        const uint8_t *maskp = mask ? vsapi->getReadPtr(mask, 0) : NULL;
+        const int mask_stride = mask ? vsapi->getStride(mask, 0) : 0;
+
+        const int top_first = d->fields && isTopFieldFirst(src, vsapi);
+        int field_height[3];
+
+        // Skip counting if the histograms were saved earlier.
+        uint32_t stored_size = 0;
+        const uint8_t *stored = d->index ? histIndexGet(d->index, n, &stored_size) : NULL;
+        if (stored) {
+            for (plane = 0; plane < fi->numPlanes; plane++) {
+                for (y = 0; y < 256; y++) {
+                    uint32_t count;
+                    memcpy(&count, stored + (plane * 256 + y) * sizeof(uint32_t), sizeof(count));
+                    hist[plane][y] = count;
+                }
+            }
+        }
 
         for (plane = 0; plane < fi->numPlanes; plane++) {
             srcp[plane] = vsapi->getReadPtr(src, plane);
@@ -301,31 +464,109 @@ static const VSFrame *VS_CC levelsGetFrame(int n, int activationReason, void *in
 
             dst_height[plane] = vsapi->getFrameHeight(dst, plane);
 
-            // Copy src to dst one line at a time.
-            for (y = 0; y < src_height[plane]; y++) {
-                memcpy(dstp[plane] + dst_stride[plane] * y,
-                    srcp[plane] + src_stride[plane] * y,
-                    src_stride[plane]);
+            panelp[plane] = dstp[plane] + src_width[plane] * fi->bytesPerSample;
+
+            // Copy src to dst one line at a time. The overlay does
+            // that itself, see below.
+            if (!d->illegal) {
+                for (y = 0; y < src_height[plane]; y++) {
+                    memcpy(dstp[plane] + dst_stride[plane] * y,
+                        srcp[plane] + src_stride[plane] * y,
+                        src_stride[plane]);
+                }
             }
 
-            // If src was less than 256 px tall, make the extra lines black.
+            // If src was less than the panel, make the extra lines black.
+            // (All bits zero is also 0.0 for float chroma.)
             if (src_height[plane] < dst_height[plane]) {
                 memset(dstp[plane] + src_height[plane] * dst_stride[plane],
-                    (plane == 0 || fi->colorFamily == cfRGB) ? 0 : 128,
+                    (plane == 0 || fi->colorFamily == cfRGB || d->is_float) ? 0 : 128,
                     (dst_height[plane] - src_height[plane]) * dst_stride[plane]);
             }
 
             // Fill the hist arrays.
-            for (y = 0; y < src_height[plane]; y++) {
-                for (x = 0; x < src_width[plane]; x++) {
-                    hist[plane][srcp[plane][y * src_stride[plane] + x]]++;
+            const int subW = plane ? fi->subSamplingW : 0;
+            const int subH = plane ? fi->subSamplingH : 0;
+            const FloatBins *bins = d->bins ? &d->bins[plane] : NULL;
+
+            if (d->fields) {
+                // The first field's lines are drawn as the bars, the second's as the trace.
+                if (top_first)
+                    d->count_fields[plane](hist[plane], hist2[plane], srcp[plane], src_stride[plane], src_width[plane], src_height[plane], maskp, mask_stride, subW, subH, bins);
+                else
+                    d->count_fields[plane](hist2[plane], hist[plane], srcp[plane], src_stride[plane], src_width[plane], src_height[plane], maskp, mask_stride, subW, subH, bins);
+
+                field_height[plane] = (src_height[plane] + 1) / 2;
+            }
+            else if (!stored && !d->illegal) {
+                d->count[plane](hist[plane], srcp[plane], src_stride[plane], src_width[plane], src_height[plane], maskp, mask_stride, subW, subH, bins);
+            }
+
+            if (cmp)
+                d->count[plane](hist2[plane], vsapi->getReadPtr(cmp, plane), vsapi->getStride(cmp, plane), src_width[plane], src_height[plane], maskp, mask_stride, subW, subH, bins);
+        }
+
+        // Copy, count and paint the illegal pixels in a single pass.
+        if (d->illegal) {
+            VSMap *props = vsapi->getFramePropertiesRW(dst);
+
+            int illegal = d->illegal_luma(hist[Y], srcp[Y], src_stride[Y], dstp[Y], dst_stride[Y], src_width[Y], src_height[Y], maskp, mask_stride);
+            vsapi->mapSetInt(props, "illegal_luma", illegal, maReplace);
+
+            if (fi->colorFamily == cfYUV) {
+                illegal = d->illegal_chroma(hist[U], hist[V], srcp, src_stride, dstp, dst_stride, src_width[U], src_height[U], maskp, mask_stride, fi->subSamplingW, fi->subSamplingH);
+                vsapi->mapSetInt(props, "illegal_chroma", illegal, maReplace);
+            }
+        }
+
+        panelBlit(&d->panel, panelp, dst_stride, dst_height);
+
+        // The drawing functions clamp hist, so hand it over before that.
+        if (d->export) {
+            uint32_t counts[3][256];
+
+            // Both fields together, so the file looks the same either way.
+            for (plane = 0; plane < fi->numPlanes; plane++)
+                for (y = 0; y < 256; y++)
+                    counts[plane][y] = hist[plane][y] + (d->fields ? hist2[plane][y] : 0);
+
+            histExportPush(d->export, n, counts, fi->numPlanes * 256 * sizeof(uint32_t));
+        }
+
+        if (d->publisher) {
+            HistShmRecord record;
+            memset(&record, 0, sizeof(record));
+            record.frame = n;
+            record.num_planes = fi->numPlanes;
+
+            for (plane = 0; plane < fi->numPlanes; plane++) {
+                int64_t total = 0;
+                double sum = 0.0;
+
+                record.min[plane] = 255;
+                for (y = 0; y < 256; y++) {
+                    const uint32_t count = hist[plane][y] + (d->fields ? hist2[plane][y] : 0);
+
+                    record.hist[plane][y] = count;
+                    if (count) {
+                        record.min[plane] = MIN(record.min[plane], (uint32_t)y);
+                        record.max[plane] = y;
+                    }
+                    total += count;
+                    sum += (double)count * y;
                 }
+
+                record.mean[plane] = total ? sum / total : 0.0;
             }
+
+            histPublish(d->publisher, &record);
         }
 
-        (fi->colorFamily == cfRGB ? drawRGB : drawYUV)(dstp, src_width, src_height, dst_height, dst_stride, hist, d->factor, fi);
+        d->drawBars(panelp, dst_stride, src_width, d->fields ? field_height : src_height, hist, (cmp || d->fields) ? hist2 : NULL, d->diff, d->factor, fi, d->panel.zoom, d->is_float ? d->float_tab : NULL);
 
         vsapi->freeFrame(src);
+        vsapi->freeFrame(mask);
+        vsapi->freeFrame(cmp);
 
         return dst;
     }
@@ -337,6 +578,13 @@ static const VSFrame *VS_CC levelsGetFrame(int n, int activationReason, void *in
 static void VS_CC levelsFree(void *instanceData, VSCore *core, const VSAPI *vsapi) {
     LevelsData *d = (LevelsData *)instanceData;
     vsapi->freeNode(d->node);
+    vsapi->freeNode(d->mask);
+    vsapi->freeNode(d->compare);
+    histExportClose(d->export);
+    histIndexClose(d->index);
+    histPublishClose(d->publisher);
+    panelFree(&d->panel);
+    free(d->bins);
     free(d);
 }
 
@@ -349,6 +597,13 @@ void VS_CC levelsCreate(const VSMap *in, VSMap *out, void *userData, VSCore *cor
     d.node = vsapi->mapGetNode(in, "clip", 0, 0);
     d.vi = *vsapi->getVideoInfo(d.node);
 
+    d.mask = vsapi->mapGetNode(in, "mask", 0, &err);
+    d.compare = vsapi->mapGetNode(in, "compare", 0, &err);
+
+    d.diff = !!vsapi->mapGetInt(in, "diff", 0, &err);
+    d.fields = !!vsapi->mapGetInt(in, "fields", 0, &err);
+    d.illegal = !!vsapi->mapGetInt(in, "illegal", 0, &err);
+
     d.factor = vsapi->mapGetFloat(in, "factor", 0, &err);
     if (err) {
         d.factor = 100.0;
@@ -358,24 +613,347 @@ void VS_CC levelsCreate(const VSMap *in, VSMap *out, void *userData, VSCore *cor
     if (d.factor < 0.0 || d.factor > 100.0) {
         vsapi->mapSetError(out, "Levels: factor must be between 0 and 100 (inclusive)");
         vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
+        return;
+    }
+
+    d.size = vsapi->mapGetIntSaturated(in, "size", 0, &err);
+    if (err)
+        d.size = 256;
+
+    if (d.size != 128 && d.size != 256 && d.size != 512) {
+        vsapi->mapSetError(out, "Levels: size must be 128, 256 or 512");
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
+        return;
+    }
+
+    if (!vsh_isConstantVideoFormat(&d.vi)
+        || !((d.vi.format.sampleType == stInteger && d.vi.format.bitsPerSample == 8)
+             || (d.vi.format.sampleType == stFloat && d.vi.format.bitsPerSample == 32))) {
+        vsapi->mapSetError(out, "Levels: only constant format 8bit integer or 32bit float input supported");
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
+        return;
+    }
+
+    d.is_float = d.vi.format.sampleType == stFloat;
+
+    // How float samples are put in the bins.
+    double range[2] = { 0.0, 1.0 };
+    int transfer = TRANSFER_LINEAR;
+    double nits;
+    int float_err = 0;
+    int float_args = 0;
+
+    if (vsapi->mapNumElements(in, "range") >= 0) {
+        float_args = 1;
+        if (vsapi->mapNumElements(in, "range") != 2) {
+            float_err = 1;
+        }
+        else {
+            range[0] = vsapi->mapGetFloat(in, "range", 0, &err);
+            range[1] = vsapi->mapGetFloat(in, "range", 1, &err);
+            float_err = !(range[0] < range[1]);
+        }
+    }
+
+    if (float_err) {
+        vsapi->mapSetError(out, "Levels: range must be two values, the lowest first");
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
+        return;
+    }
+
+    const char *transfer_name = vsapi->mapGetData(in, "transfer", 0, &err);
+    if (!err) {
+        float_args = 1;
+        if (!strcmp(transfer_name, "pq"))
+            transfer = TRANSFER_PQ;
+        else if (!strcmp(transfer_name, "hlg"))
+            transfer = TRANSFER_HLG;
+        else if (strcmp(transfer_name, "linear"))
+            float_err = 1;
+    }
+
+    if (float_err) {
+        vsapi->mapSetError(out, "Levels: transfer must be linear, pq or hlg");
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
+        return;
+    }
+
+    nits = vsapi->mapGetFloat(in, "nits", 0, &err);
+    if (err)
+        nits = 100.0;
+    else
+        float_args = 1;
+
+    if (nits <= 0.0) {
+        vsapi->mapSetError(out, "Levels: nits must be greater than 0");
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
+        return;
+    }
+
+    if (float_args && !d.is_float) {
+        vsapi->mapSetError(out, "Levels: range, transfer and nits are only used with float input");
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
+        return;
+    }
+
+    if (d.mask && !checkMask(vsapi->getVideoInfo(d.mask), &d.vi)) {
+        vsapi->mapSetError(out, "Levels: mask must be a constant format 8bit integer clip with the same dimensions as clip");
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
         return;
     }
 
-    if (!vsh_isConstantVideoFormat(&d.vi) || d.vi.format.sampleType != stInteger || d.vi.format.bitsPerSample != 8) {
-        vsapi->mapSetError(out, "Levels: only constant format 8bit integer input supported");
+    if (d.compare && !checkCompare(vsapi->getVideoInfo(d.compare), &d.vi)) {
+        vsapi->mapSetError(out, "Levels: compare must have the same format and dimensions as clip");
         vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
         return;
     }
 
+    vsapi->mapGetData(in, "index", 0, &err);
+    if (d.fields && (d.compare || !err)) {
+        vsapi->mapSetError(out, "Levels: fields can't be used together with compare or index");
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
+        return;
+    }
+
+    if (d.illegal && (d.fields || !err)) {
+        vsapi->mapSetError(out, "Levels: illegal can't be used together with fields or index");
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
+        return;
+    }
+
+    if (d.illegal && (d.is_float || d.vi.format.colorFamily == cfRGB)) {
+        vsapi->mapSetError(out, "Levels: illegal is only supported for 8bit integer YUV and Gray input");
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
+        return;
+    }
+
+    int publish_slots = vsapi->mapGetIntSaturated(in, "publish_slots", 0, &err);
+    if (err)
+        publish_slots = 64;
+
+    if (publish_slots < 1) {
+        vsapi->mapSetError(out, "Levels: publish_slots must be at least 1");
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
+        return;
+    }
+
+    HistSettings settings = { .masked = !!d.mask };
+    if (d.is_float)
+        settings = (HistSettings){ !!d.mask, { range[0], range[1] }, nits, transfer };
+
+    if (!openExportAndIndex(in, out, "Levels", HIST_KIND_LEVELS, &d.vi, &settings, &d.export, &d.index, vsapi)) {
+        vsapi->freeNode(d.node);
+        vsapi->freeNode(d.mask);
+        vsapi->freeNode(d.compare);
+        return;
+    }
+
+    d.publisher = NULL;
+    const char *publish = vsapi->mapGetData(in, "publish", 0, &err);
+    if (!err) {
+        char msg[256];
+        char error[300];
+
+        d.publisher = histPublishOpen(publish, publish_slots, d.vi.format.numPlanes, d.vi.width, d.vi.height, histFormatId(&d.vi.format), msg, sizeof(msg));
+        if (!d.publisher) {
+            snprintf(error, sizeof(error), "Levels: %s", msg);
+            vsapi->mapSetError(out, error);
+            histExportClose(d.export);
+            histIndexClose(d.index);
+            vsapi->freeNode(d.node);
+            vsapi->freeNode(d.mask);
+            vsapi->freeNode(d.compare);
+            return;
+        }
+    }
+
+    d.illegal_luma = selectIllegalLuma8(!!d.mask);
+    d.illegal_chroma = selectIllegalChroma8(!!d.mask, d.vi.format.subSamplingW, d.vi.format.subSamplingH);
+
+    d.bins = NULL;
+    if (d.is_float)
+        d.bins = (FloatBins *)malloc(d.vi.format.numPlanes * sizeof(FloatBins));
+
+    for (int plane = 0; plane < d.vi.format.numPlanes; plane++) {
+        const int subW = plane ? d.vi.format.subSamplingW : 0;
+        const int subH = plane ? d.vi.format.subSamplingH : 0;
+
+        if (!d.is_float) {
+            d.count[plane] = selectCountPlane(!!d.mask, subW, subH);
+            d.count_fields[plane] = selectCountFields(!!d.mask, subW, subH);
+            continue;
+        }
+
+        // Float chroma is always centred on 0.
+        if (plane && d.vi.format.colorFamily == cfYUV)
+            floatBinsInit(&d.bins[plane], TRANSFER_LINEAR, -0.5, 0.5, nits);
+        else
+            floatBinsInit(&d.bins[plane], transfer, range[0], range[1], nits);
+
+        d.count[plane] = selectCountPlaneFloat(d.bins[plane].transfer, !!d.mask, subW, subH);
+        d.count_fields[plane] = selectCountFieldsFloat(d.bins[plane].transfer, !!d.mask, subW, subH);
+    }
+
+    if (d.is_float) {
+        // The panel is drawn in limited range for YUV and Gray.
+        for (int i = 0; i < 256; i++) {
+            if (d.vi.format.colorFamily == cfRGB) {
+                d.float_tab[0][i] = d.float_tab[1][i] = d.float_tab[2][i] = i / 255.0f;
+            }
+            else {
+                d.float_tab[0][i] = MIN(MAX((i - 16) / 219.0f, 0.0f), 1.0f);
+                d.float_tab[1][i] = d.float_tab[2][i] = MIN(MAX((i - 128) / 224.0f, -0.5f), 0.5f);
+            }
+        }
+    }
+
+    d.drawBars = levelsPanelInit(&d.panel, &d.vi.format, d.size, d.is_float ? d.float_tab : NULL, core, vsapi);
+
     if (d.vi.width)
-        d.vi.width += 256;
+        d.vi.width += d.size;
     if (d.vi.height)
-        d.vi.height = MAX(256, d.vi.height);
+        d.vi.height = MAX(d.size, d.vi.height);
 
     data = (LevelsData *)malloc(sizeof(d));
     *data = d;
 
-    VSFilterDependency deps[] = { {d.node, rpStrictSpatial} };
-    vsapi->createVideoFilter(out, "Levels", &d.vi, levelsGetFrame, levelsFree, fmParallel, deps, 1, data, core);
+    VSFilterDependency deps[3] = { {d.node, rpStrictSpatial} };
+    int numDeps = 1;
+    if (d.mask)
+        deps[numDeps++] = (VSFilterDependency){ d.mask, rpStrictSpatial };
+    if (d.compare)
+        deps[numDeps++] = (VSFilterDependency){ d.compare, rpStrictSpatial };
+
+    vsapi->createVideoFilter(out, "Levels", &d.vi, levelsGetFrame, levelsFree, fmParallel, deps, numDeps, data, core);
+}
+
+
+
+static void benchCountWith(const BenchFrame *f, int masked, int generic) {
+    for (int plane = 0; plane < f->fi->numPlanes; plane++) {
+        const int subW = plane ? f->fi->subSamplingW : 0;
+        const int subH = plane ? f->fi->subSamplingH : 0;
+        int hist[256] = { 0 };
+
+        CountPlaneFunc count = generic ? countPlane : selectCountPlane(masked, subW, subH);
+        count(hist, f->srcp[plane], f->src_stride[plane], f->width[plane], f->height[plane], masked ? f->maskp : NULL, f->mask_stride, subW, subH, NULL);
+    }
+}
+
+
+static void benchCount(const BenchFrame *f, const void *data) {
+    benchCountWith(f, 0, 0);
+}
+
+
+static void benchCountMasked(const BenchFrame *f, const void *data) {
+    benchCountWith(f, 1, 0);
+}
+
+
+static void benchCountMaskedGeneric(const BenchFrame *f, const void *data) {
+    benchCountWith(f, 1, 1);
+}
+
+
+static void benchCountFields(const BenchFrame *f, const void *data) {
+    for (int plane = 0; plane < f->fi->numPlanes; plane++) {
+        int hist[2][256] = { { 0 } };
+
+        countPlaneFields(hist[0], hist[1], f->srcp[plane], f->src_stride[plane], f->width[plane], f->height[plane], NULL, 0, 0, 0, NULL);
+    }
+}
+
+
+typedef struct {
+    FloatBins linear;
+    FloatBins chroma;
+    FloatBins pq;
+} LevelsBenchData;
+
+
+// The chroma of YUV clips always uses its own bins, like in levelsCreate.
+static void benchCountFloatWith(const BenchFrame *f, const LevelsBenchData *b, const FloatBins *bins) {
+    for (int plane = 0; plane < f->fi->numPlanes; plane++) {
+        const int chroma = plane && f->fi->colorFamily == cfYUV;
+        int hist[256] = { 0 };
+
+        countPlaneFloat(hist, f->srcp[plane], f->src_stride[plane], f->width[plane], f->height[plane], NULL, 0, 0, 0, chroma ? &b->chroma : bins);
+    }
 }
 
+
+static void benchCountFloat(const BenchFrame *f, const void *data) {
+    const LevelsBenchData *b = (const LevelsBenchData *)data;
+    benchCountFloatWith(f, b, &b->linear);
+}
+
+
+static void benchCountFloatPQ(const BenchFrame *f, const void *data) {
+    const LevelsBenchData *b = (const LevelsBenchData *)data;
+    benchCountFloatWith(f, b, &b->pq);
+}
+
+
+// Draws f->hist at the top left of dstp, without the template.
+static void benchDraw(const BenchFrame *f, const void *data) {
+    uint8_t *dstp[3] = { f->dstp[0], f->dstp[1], f->dstp[2] };
+    int hist[3][256];
+
+    // The drawing functions clamp it.
+    memcpy(hist, f->hist, sizeof(hist));
+
+    (f->fi->colorFamily == cfRGB ? drawRGBBars : drawYUVBars)(dstp, f->dst_stride, f->width, f->height, hist, NULL, 0, 100.0, f->fi, 0, NULL);
+}
+
+
+int levelsBenchKernels(const VSVideoFormat *fi, BenchKernel kernels[BENCH_MAX_KERNELS], void **data) {
+    if (fi->sampleType == stFloat && fi->bitsPerSample == 32) {
+        LevelsBenchData *b = (LevelsBenchData *)malloc(sizeof(LevelsBenchData));
+        floatBinsInit(&b->linear, TRANSFER_LINEAR, 0.0, 1.0, 100.0);
+        floatBinsInit(&b->chroma, TRANSFER_LINEAR, -0.5, 0.5, 100.0);
+        floatBinsInit(&b->pq, TRANSFER_PQ, 0.0, 1.0, 100.0);
+        *data = b;
+
+        kernels[0] = (BenchKernel){ "count_float", benchCountFloat };
+        kernels[1] = (BenchKernel){ "count_float_pq", benchCountFloatPQ };
+        kernels[2] = (BenchKernel){ "draw", benchDraw };
+        return 3;
+    }
+
+    if (fi->sampleType != stInteger || fi->bitsPerSample != 8)
+        return 0;
+
+    kernels[0] = (BenchKernel){ "count", benchCount };
+    kernels[1] = (BenchKernel){ "count_masked", benchCountMasked };
+    kernels[2] = (BenchKernel){ "count_masked_generic", benchCountMaskedGeneric };
+    kernels[3] = (BenchKernel){ "count_fields", benchCountFields };
+    kernels[4] = (BenchKernel){ "draw", benchDraw };
+    return 5;
+}
@@ -0,0 +1,23 @@
+#ifndef LEVELS_H
+#define LEVELS_H
+
+#include <stdint.h>
+#include <VapourSynth4.h>
+
+#include "panel.h"
+
+// Draws the bars of the histograms of every plane in the Levels panel,
+// straight into the frame, at the size of the template (zoom is the
+// template's). hist2, if not NULL, is drawn as the trace (or, with diff, the
+// shaded difference). The bars are clamped at factor percent of each
+// plane's number of pixels, and hist and hist2 are clamped with them. tab
+// is the one the template was made with.
+typedef void (*LevelsDrawBarsFunc)(uint8_t *dstp[3], const int dst_stride[3], const int src_width[3], const int src_height[3], int hist[3][256], int (*hist2)[256], int diff, double factor, const VSVideoFormat *fi, int zoom, const float (*tab)[256]);
+
+// Makes the template of the Levels panel for clips of format fi, at size px
+// (128, 256 or 512), and returns the function that draws the bars on it.
+// The template is 8 bit, unless tab is not NULL: then it's 32 bit float,
+// with every 8 bit value mapped through tab.
+LevelsDrawBarsFunc levelsPanelInit(Panel *p, const VSVideoFormat *fi, int size, const float (*tab)[256], VSCore *core, const VSAPI *vsapi);
+
+#endif
@@ -1,13 +1,95 @@
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <VapourSynth4.h>
 #include "VSHelper4.h"
 
-typedef struct {
+#include "bench.h"
+
+typedef struct LumaData LumaData;
+
+// d is only used by the float version.
+typedef void (*LumaFunc)(const uint8_t *srcp, int src_stride, uint8_t *dstp, int dst_stride, int width, int height, const LumaData *d);
+
+struct LumaData {
     VSNode *node;
     VSVideoInfo vi;
-    uint16_t maxVal;
-} LumaData;
+    LumaFunc luma; // Chosen in lumaCreate.
+
+    // Float clips only. The input range, as lo + [0, 1] / scale.
+    float lo;
+    float scale;
+};
+
+
+// One version per bit depth, so maxVal is a constant.
+#define LUMA(name, pixel_t, BITS) \
+static void name(const uint8_t *srcp, int src_stride, uint8_t *dstp, int dst_stride, int width, int height, const LumaData *d) { \
+    const int maxVal = (1 << (BITS)) - 1; \
+    int x, y; \
+    \
+    for (y = 0; y < height; y++) { \
+        const pixel_t *srcrow = (const pixel_t *)(srcp + y * src_stride); \
+        pixel_t *dstrow = (pixel_t *)(dstp + y * dst_stride); \
+        \
+        for (x = 0; x < width; x++) { \
+            int p = srcrow[x] << 4; \
+            dstrow[x] = (p & (maxVal + 1)) ? (maxVal - (p & maxVal)) : p & maxVal; \
+        } \
+    } \
+}
+
+LUMA(luma8, uint8_t, 8)
+LUMA(luma9, uint16_t, 9)
+LUMA(luma10, uint16_t, 10)
+LUMA(luma11, uint16_t, 11)
+LUMA(luma12, uint16_t, 12)
+LUMA(luma13, uint16_t, 13)
+LUMA(luma14, uint16_t, 14)
+LUMA(luma15, uint16_t, 15)
+LUMA(luma16, uint16_t, 16)
+
+
+// Same thing in float: the range is stretched 16 times, and every other
+// copy is mirrored, so the output goes from 0 to 1 and back 8 times.
+static void lumaFloat(const uint8_t *srcp, int src_stride, uint8_t *dstp, int dst_stride, int width, int height, float lo, float scale) {
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        const float *srcrow = (const float *)(srcp + y * src_stride);
+        float *dstrow = (float *)(dstp + y * dst_stride);
+
+        for (x = 0; x < width; x++) {
+            float p = (srcrow[x] - lo) * scale * 16.0f;
+
+            // Also catches NaN.
+            if (!(p >= 0.0f))
+                p = 0.0f;
+            p = fminf(p, 16.0f);
+
+            const float i = floorf(p);
+            dstrow[x] = ((int)i & 1) ? 1.0f - (p - i) : p - i;
+        }
+    }
+}
+
+
+// lumaFloat as a LumaFunc, with the range taken from d.
+static void lumaFloatRange(const uint8_t *srcp, int src_stride, uint8_t *dstp, int dst_stride, int width, int height, const LumaData *d) {
+    lumaFloat(srcp, src_stride, dstp, dst_stride, width, height, d->lo, d->scale);
+}
+
+
+static LumaFunc selectLuma(const VSVideoFormat *fi) {
+    static const LumaFunc funcs[] = {
+        luma8, luma9, luma10, luma11, luma12, luma13, luma14, luma15, luma16
+    };
+
+    if (fi->sampleType == stFloat)
+        return lumaFloatRange;
+
+    return funcs[fi->bitsPerSample - 8];
+}
 
 
 static const VSFrame *VS_CC lumaGetFrame(int n, int activationReason, void *instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
@@ -25,41 +107,7 @@ static const VSFrame *VS_CC lumaGetFrame(int n, int activationReason, void *inst
 
         VSFrame *dst = vsapi->newVideoFrame(fi, src_width, src_height, src, core);
 
-        int src_stride = vsapi->getStride(src, 0);
-        int dst_stride = vsapi->getStride(dst, 0);
-
-        const uint8_t highBitDepth = fi->bitsPerSample / 9;
-
-        int y;
-        int x;
-
-        //Some duplicate code due to lack of templates
-        if (highBitDepth) {
-            src_stride /= 2;
-            dst_stride /= 2;
-            const uint16_t *srcp = (const uint16_t *)vsapi->getReadPtr(src, 0);
-            uint16_t *dstp = (uint16_t *)vsapi->getWritePtr(dst, 0);
-            for (y = 0; y < src_height; y++) {
-                for (x = 0; x < src_width; x++) {
-                    int p = srcp[x] << 4;
-                    dstp[x] = (p & (d->maxVal + 1)) ? (d->maxVal - (p & d->maxVal)) : p & d->maxVal;
-                }
-                srcp += src_stride;
-                dstp += dst_stride;
-            }
-        }
-        else {
-            const uint8_t *srcp = vsapi->getReadPtr(src, 0);
-            uint8_t *dstp = vsapi->getWritePtr(dst, 0);
-            for (y = 0; y < src_height; y++) {
-                for (x = 0; x < src_width; x++) {
-                    int p = srcp[x] << 4;
-                    dstp[x] = (p & (d->maxVal + 1)) ? (d->maxVal - (p & d->maxVal)) : p & d->maxVal;
-                }
-                srcp += src_stride;
-                dstp += dst_stride;
-            }
-        }
+        d->luma(vsapi->getReadPtr(src, 0), vsapi->getStride(src, 0), vsapi->getWritePtr(dst, 0), vsapi->getStride(dst, 0), src_width, src_height, d);
 
         vsapi->freeFrame(src);
 
@@ -80,20 +128,46 @@ static void VS_CC lumaFree(void *instanceData, VSCore *core, const VSAPI *vsapi)
 void VS_CC lumaCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
     LumaData d;
     LumaData *data;
+    int err;
 
     d.node = vsapi->mapGetNode(in, "clip", 0, 0);
     d.vi = *vsapi->getVideoInfo(d.node);
 
-    if (!vsh_isConstantVideoFormat(&d.vi) || d.vi.format.sampleType != stInteger || d.vi.format.bitsPerSample > 16) {
-        vsapi->mapSetError(out, "Luma: only constant format 8 to 16 bit integer input supported");
+    if (!vsh_isConstantVideoFormat(&d.vi)
+        || !((d.vi.format.sampleType == stInteger && d.vi.format.bitsPerSample <= 16)
+             || (d.vi.format.sampleType == stFloat && d.vi.format.bitsPerSample == 32))) {
+        vsapi->mapSetError(out, "Luma: only constant format 8 to 16 bit integer or 32 bit float input supported");
         vsapi->freeNode(d.node);
         return;
     }
 
+    double range[2] = { 0.0, 1.0 };
+
+    if (vsapi->mapNumElements(in, "range") >= 0) {
+        if (d.vi.format.sampleType != stFloat) {
+            vsapi->mapSetError(out, "Luma: range is only used with float input");
+            vsapi->freeNode(d.node);
+            return;
+        }
+
+        if (vsapi->mapNumElements(in, "range") != 2
+            || !(vsapi->mapGetFloat(in, "range", 0, &err) < vsapi->mapGetFloat(in, "range", 1, &err))) {
+            vsapi->mapSetError(out, "Luma: range must be two values, the lowest first");
+            vsapi->freeNode(d.node);
+            return;
+        }
+
+        range[0] = vsapi->mapGetFloat(in, "range", 0, &err);
+        range[1] = vsapi->mapGetFloat(in, "range", 1, &err);
+    }
+
+    d.lo = (float)range[0];
+    d.scale = (float)(1.0 / (range[1] - range[0]));
+
     // We don't need any chroma.
-    vsapi->queryVideoFormat(&d.vi.format, cfGray, stInteger, d.vi.format.bitsPerSample, 0, 0, core);
+    vsapi->queryVideoFormat(&d.vi.format, cfGray, d.vi.format.sampleType, d.vi.format.bitsPerSample, 0, 0, core);
 
-    d.maxVal = (1 << d.vi.format.bitsPerSample) - 1;
+    d.luma = selectLuma(&d.vi.format);
 
     data = (LumaData *)malloc(sizeof(d));
     *data = d;
@@ -102,3 +176,19 @@ void VS_CC lumaCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core,
     vsapi->createVideoFilter(out, "Luma", &d.vi, lumaGetFrame, lumaFree, fmParallel, deps, 1, data, core);
 }
 
+
+static void benchLuma(const BenchFrame *f, const void *data) {
+    // The default range.
+    LumaData d = { .lo = 0.0f, .scale = 1.0f };
+
+    selectLuma(f->fi)(f->srcp[0], f->src_stride[0], f->dstp[0], f->dst_stride[0], f->width[0], f->height[0], &d);
+}
+
+
+int lumaBenchKernels(const VSVideoFormat *fi, BenchKernel kernels[BENCH_MAX_KERNELS], void **data) {
+    if (!((fi->sampleType == stInteger && fi->bitsPerSample <= 16) || (fi->sampleType == stFloat && fi->bitsPerSample == 32)))
+        return 0;
+
+    kernels[0] = (BenchKernel){ "luma", benchLuma };
+    return 1;
+}
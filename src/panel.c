@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "panel.h"
+
+
+void panelInit(Panel *p, const VSVideoFormat *fi, int width, int height, const uint8_t fill[3]) {
+    memset(p, 0, sizeof(Panel));
+    p->num_planes = fi->numPlanes;
+
+    for (int plane = 0; plane < p->num_planes; plane++) {
+        const int subW = (plane && fi->colorFamily != cfRGB) ? fi->subSamplingW : 0;
+        const int subH = (plane && fi->colorFamily != cfRGB) ? fi->subSamplingH : 0;
+
+        p->width[plane] = (width >> subW) * fi->bytesPerSample;
+        p->height[plane] = height >> subH;
+        p->fill[plane] = fill[plane];
+        p->data[plane] = (uint8_t *)malloc(p->width[plane] * p->height[plane]);
+        memset(p->data[plane], fill[plane], p->width[plane] * p->height[plane]);
+    }
+}
+
+
+void panelCopy(Panel *dst, const Panel *src) {
+    *dst = *src;
+
+    for (int plane = 0; plane < src->num_planes; plane++) {
+        dst->data[plane] = (uint8_t *)malloc(src->width[plane] * src->height[plane]);
+        memcpy(dst->data[plane], src->data[plane], src->width[plane] * src->height[plane]);
+    }
+}
+
+
+void panelBlit(const Panel *p, uint8_t *dstp[3], const int dst_stride[3], const int dst_height[3]) {
+    for (int plane = 0; plane < p->num_planes; plane++) {
+        int y;
+
+        for (y = 0; y < p->height[plane] && y < dst_height[plane]; y++)
+            memcpy(dstp[plane] + y * dst_stride[plane], p->data[plane] + y * p->width[plane], p->width[plane]);
+
+        for (; y < dst_height[plane]; y++)
+            memset(dstp[plane] + y * dst_stride[plane], p->fill[plane], p->width[plane]);
+    }
+}
+
+
+void panelScale(Panel *p, int size) {
+    const int zoom = (size > 256) - (size < 256);
+
+    if (!zoom)
+        return;
+
+    for (int plane = 0; plane < p->num_planes; plane++) {
+        const int width = zoom > 0 ? p->width[plane] * 2 : p->width[plane] / 2;
+        const int height = zoom > 0 ? p->height[plane] * 2 : p->height[plane] / 2;
+        const uint8_t *srcp = p->data[plane];
+        const int src_stride = p->width[plane];
+        uint8_t *dstp = (uint8_t *)malloc(width * height);
+
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                if (zoom > 0)
+                    dstp[y * width + x] = srcp[(y >> 1) * src_stride + (x >> 1)];
+                else
+                    dstp[y * width + x] = (srcp[y * 2 * src_stride + x * 2] + srcp[y * 2 * src_stride + x * 2 + 1] +
+                                           srcp[(y * 2 + 1) * src_stride + x * 2] + srcp[(y * 2 + 1) * src_stride + x * 2 + 1] + 2) >> 2;
+            }
+        }
+
+        free(p->data[plane]);
+        p->data[plane] = dstp;
+        p->width[plane] = width;
+        p->height[plane] = height;
+    }
+
+    p->zoom = zoom;
+}
+
+
+void panelToFloat(Panel *p, const float (*tab)[256]) {
+    for (int plane = 0; plane < p->num_planes; plane++) {
+        const int size = p->width[plane] * p->height[plane];
+        float *dstp = (float *)malloc(size * sizeof(float));
+
+        for (int i = 0; i < size; i++)
+            dstp[i] = tab[plane][p->data[plane][i]];
+
+        free(p->data[plane]);
+        p->data[plane] = (uint8_t *)dstp;
+        p->width[plane] *= sizeof(float);
+
+        // All bits zero is also 0.0.
+        p->fill[plane] = 0;
+    }
+}
+
+
+void panelFree(Panel *p) {
+    for (int plane = 0; plane < p->num_planes; plane++)
+        free(p->data[plane]);
+}
@@ -0,0 +1,58 @@
+#ifndef PANEL_H
+#define PANEL_H
+
+#include <stdint.h>
+#include <VapourSynth4.h>
+
+// The parts of a histogram panel that don't depend on the frame, drawn once
+// when the filter is created and copied into every output frame.
+
+typedef struct {
+    int num_planes;
+    int width[3]; // In bytes.
+    int height[3];
+    uint8_t *data[3];
+    uint8_t fill[3]; // Value of the rows below the template.
+    int zoom; // The template was drawn at 256 px and scaled by 2^zoom (-1, 0 or 1).
+} Panel;
+
+
+// width and height are in luma pixels. The template starts out filled with fill,
+// and zoom is 0.
+void panelInit(Panel *p, const VSVideoFormat *fi, int width, int height, const uint8_t fill[3]);
+
+// Scales the 8 bit template drawn at 256 px to size px (128, 256 or 512),
+// when the filter is created, so the frames can be drawn at that size
+// directly. Halving averages 2x2 blocks, doubling repeats every pixel.
+void panelScale(Panel *p, int size);
+
+// Converts the 8 bit template to 32 bit float, every value through tab.
+// The rows below it become 0.0.
+void panelToFloat(Panel *p, const float (*tab)[256]);
+
+// Makes dst a copy of src, with its own data.
+void panelCopy(Panel *dst, const Panel *src);
+
+// dstp points to the top left corner of the panel in each plane.
+void panelBlit(const Panel *p, uint8_t *dstp[3], const int dst_stride[3], const int dst_height[3]);
+
+void panelFree(Panel *p);
+
+
+// Where pixel c of the 256 px layout starts in a panel scaled by 2^zoom.
+static inline int panelPos(int zoom, int c) {
+    return (c << 1) >> (1 - zoom);
+}
+
+// The last pixel covered by pixel c of the 256 px layout.
+static inline int panelLast(int zoom, int c) {
+    return panelPos(zoom, c + 1) - 1;
+}
+
+// How many of the 256 bins (or 256 px layout pixels) go in one pixel
+// of a panel scaled by 2^zoom, along each axis.
+static inline int panelStep(int zoom) {
+    return zoom < 0 ? 2 : 1;
+}
+
+#endif
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "publish.h"
+
+
+struct HistPublisher {
+    char name[256];
+    size_t size;
+    HistShmHeader *header;
+    HistShmSlot *slots;
+};
+
+
+HistPublisher *histPublishOpen(const char *name, int num_slots, int num_planes, int width, int height, uint32_t format, char *err, size_t err_size) {
+#ifdef _WIN32
+    snprintf(err, err_size, "publish is not supported on Windows");
+    return NULL;
+#else
+    HistPublisher *p = (HistPublisher *)calloc(1, sizeof(HistPublisher));
+
+    // POSIX only promises portable behaviour for names with a leading slash.
+    snprintf(p->name, sizeof(p->name), "%s%s", name[0] == '/' ? "" : "/", name);
+    p->size = sizeof(HistShmHeader) + (size_t)num_slots * sizeof(HistShmSlot);
+
+    // A fresh object every time, so readers of an older one don't see
+    // its size change under them.
+    shm_unlink(p->name);
+
+    int fd = shm_open(p->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        snprintf(err, err_size, "failed to create shared memory object '%s': %s", p->name, strerror(errno));
+        free(p);
+        return NULL;
+    }
+
+    if (ftruncate(fd, p->size)) {
+        snprintf(err, err_size, "failed to resize shared memory object '%s': %s", p->name, strerror(errno));
+        close(fd);
+        shm_unlink(p->name);
+        free(p);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, p->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        snprintf(err, err_size, "failed to map shared memory object '%s': %s", p->name, strerror(errno));
+        shm_unlink(p->name);
+        free(p);
+        return NULL;
+    }
+
+    // ftruncate filled it with zeroes, so every slot's seq starts out even.
+    p->header = (HistShmHeader *)data;
+    p->slots = (HistShmSlot *)((uint8_t *)data + sizeof(HistShmHeader));
+
+    memcpy(p->header->magic, HIST_SHM_MAGIC, sizeof(p->header->magic));
+    p->header->version = HIST_SHM_VERSION;
+    p->header->num_slots = num_slots;
+    p->header->slot_size = sizeof(HistShmSlot);
+    p->header->num_planes = num_planes;
+    p->header->width = width;
+    p->header->height = height;
+    p->header->format = format;
+    atomic_store_explicit(&p->header->head, 0, memory_order_release);
+
+    return p;
+#endif
+}
+
+
+void histPublish(HistPublisher *p, HistShmRecord *record) {
+#ifndef _WIN32
+    const uint64_t index = atomic_fetch_add_explicit(&p->header->head, 1, memory_order_relaxed);
+    HistShmSlot *slot = &p->slots[index % p->header->num_slots];
+
+    uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    if ((seq & 1) || !atomic_compare_exchange_strong_explicit(&slot->seq, &seq, seq + 1, memory_order_relaxed, memory_order_relaxed))
+        return;
+
+    // The odd seq must be visible before any of the new record is.
+    atomic_thread_fence(memory_order_release);
+
+    record->index = index;
+    memcpy(&slot->record, record, sizeof(*record));
+
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+#endif
+}
+
+
+void histPublishClose(HistPublisher *p) {
+    if (!p)
+        return;
+
+#ifndef _WIN32
+    munmap(p->header, p->size);
+    shm_unlink(p->name);
+#endif
+    free(p);
+}
@@ -0,0 +1,89 @@
+#ifndef PUBLISH_H
+#define PUBLISH_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// The shared memory object Levels publishes to looks like this, in the
+// host's byte order:
+//
+//   HistShmHeader
+//   HistShmSlot slots[num_slots]
+//
+// head is the number of records published so far, and record i goes in
+// slot i % num_slots. Every slot is a sequence lock: seq is odd while the
+// slot is being written and goes up by 2 with every record, so a reader
+// copies the record out and only keeps it if seq was even before the copy
+// and is the same after it (see histShmRead). Writers never wait for
+// anything: one that finds its slot still being written by another (which
+// takes the ring wrapping around while a frame thread is stalled) drops
+// its record.
+
+#define HIST_SHM_MAGIC "HISTSHM"
+#define HIST_SHM_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_slots;
+    uint32_t slot_size; // sizeof(HistShmSlot), to check the layout.
+    uint32_t num_planes;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format; // See histFormatId.
+    uint32_t reserved[7];
+    _Atomic uint64_t head;
+} HistShmHeader;
+
+// The histograms are the ones Levels draws (both fields together, with
+// fields), min and max are the lowest and highest non-empty bins, mean is
+// the mean bin.
+typedef struct {
+    uint64_t index; // Which record this is, to tell it from older laps.
+    int32_t frame;
+    uint32_t num_planes;
+    uint32_t hist[3][256];
+    uint32_t min[3];
+    uint32_t max[3];
+    double mean[3];
+} HistShmRecord;
+
+typedef struct {
+    _Atomic uint32_t seq;
+    uint32_t reserved;
+    HistShmRecord record;
+} HistShmSlot;
+
+
+// For readers. Returns 0 if the slot was being written (the copy must be
+// thrown away and tried again) or was never written at all.
+static inline int histShmRead(const HistShmSlot *slot, HistShmRecord *record) {
+    const uint32_t before = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if (!before || (before & 1))
+        return 0;
+
+    memcpy(record, &slot->record, sizeof(*record));
+
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&slot->seq, memory_order_relaxed) == before;
+}
+
+
+typedef struct HistPublisher HistPublisher;
+
+// Creates the shared memory object (replacing any with the same name) with
+// room for num_slots records. Returns NULL and fills err on failure, and
+// always on Windows.
+HistPublisher *histPublishOpen(const char *name, int num_slots, int num_planes, int width, int height, uint32_t format, char *err, size_t err_size);
+
+// Fills in the record's index and copies it into its slot, unless another
+// thread is still writing that slot.
+void histPublish(HistPublisher *p, HistShmRecord *record);
+
+// Unmaps the object and removes its name. Readers that have it mapped can
+// keep reading the last records.
+void histPublishClose(HistPublisher *p);
+
+#endif
@@ -0,0 +1,40 @@
+#include <math.h>
+
+#include "rgb.h"
+
+
+static int fixed(double x) {
+    return (int)lround(x * 65536.0);
+}
+
+
+void rgbTablesInit(RGBTables *t, double kr, double kb) {
+    const double kg = 1.0 - kr - kb;
+    const double k[3] = { kr, kg, kb };
+
+    // Limited range: Y in [16, 235], U and V in [16, 240].
+    const double ys = 219.0 / 255.0;
+    const double us = 224.0 / 255.0 / (2.0 * (1.0 - kb));
+    const double vs = 224.0 / 255.0 / (2.0 * (1.0 - kr));
+
+    for (int i = 0; i < 256; i++) {
+        for (int c = 0; c < 3; c++) {
+            t->y[c][i] = fixed(k[c] * ys * i);
+            t->u[c][i] = fixed(((c == 2) - k[c]) * us * i);
+            t->v[c][i] = fixed(((c == 0) - k[c]) * vs * i);
+        }
+
+        t->luma[i] = fixed((i - 16) * 255.0 / 219.0 + 0.5);
+        t->rv[i] = fixed((i - 128) * 255.0 / 112.0 * (1.0 - kr));
+        t->gu[i] = fixed(-(i - 128) * 255.0 / 112.0 * (1.0 - kb) * kb / kg);
+        t->gv[i] = fixed(-(i - 128) * 255.0 / 112.0 * (1.0 - kr) * kr / kg);
+        t->bu[i] = fixed((i - 128) * 255.0 / 112.0 * (1.0 - kb));
+    }
+
+    // The offsets and the rounding.
+    for (int i = 0; i < 256; i++) {
+        t->y[0][i] += fixed(16.5);
+        t->u[0][i] += fixed(128.5);
+        t->v[0][i] += fixed(128.5);
+    }
+}
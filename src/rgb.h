@@ -0,0 +1,46 @@
+#ifndef RGB_H
+#define RGB_H
+
+#include <stdint.h>
+
+// Lookup tables to go between full range RGB and limited range YUV without
+// a conversion filter, so the chroma scopes can read RGB clips directly.
+// Everything is 16.16 fixed point, with the offsets and the rounding
+// folded into the first table of each sum.
+
+typedef struct {
+    // RGB to YUV, indexed by [R, G or B][value].
+    int y[3][256];
+    int u[3][256];
+    int v[3][256];
+
+    // YUV to RGB.
+    int luma[256];
+    int rv[256];
+    int gu[256];
+    int gv[256];
+    int bu[256];
+} RGBTables;
+
+
+// kr and kb are the matrix coefficients, e.g. 0.299 and 0.114 for BT.601.
+void rgbTablesInit(RGBTables *t, double kr, double kb);
+
+static inline void rgbToYUV(const RGBTables *t, int r, int g, int b, int *y, int *u, int *v) {
+    *y = (t->y[0][r] + t->y[1][g] + t->y[2][b]) >> 16;
+    *u = (t->u[0][r] + t->u[1][g] + t->u[2][b]) >> 16;
+    *v = (t->v[0][r] + t->v[1][g] + t->v[2][b]) >> 16;
+}
+
+static inline uint8_t rgbClamp(int x) {
+    x >>= 16;
+    return x < 0 ? 0 : x > 255 ? 255 : x;
+}
+
+static inline void yuvToRGB(const RGBTables *t, int y, int u, int v, uint8_t *r, uint8_t *g, uint8_t *b) {
+    *r = rgbClamp(t->luma[y] + t->rv[v]);
+    *g = rgbClamp(t->luma[y] + t->gu[u] + t->gv[v]);
+    *b = rgbClamp(t->luma[y] + t->bu[u]);
+}
+
+#endif
@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <VapourSynth4.h>
+#include "VSHelper4.h"
+
+#include "common.h"
+#include "panel.h"
+
+// Every frame gets 256 counts per tile and plane, so the grid is capped.
+#define TILES_MAX 4096
+
+typedef struct {
+    VSNode *node;
+    VSVideoInfo vi;
+    int columns;
+    int rows;
+    int show_panel;
+    int size;
+
+    // For every pixel of a line of each plane, where its tile's histogram
+    // starts in the tile row's histograms. Made in tilesCreate.
+    int *offsets[3];
+    Panel panel; // Only with panel.
+} TilesData;
+
+
+// Counts every tile of one plane in a single pass, line by line. The tiles
+// split the plane evenly, so their edges are at multiples of width / columns
+// and height / rows, rounded down. hist has 256 bins per tile, the tiles in
+// row-major order.
+static void countTiles(int64_t *hist, const uint8_t *srcp, int src_stride, int width, int height, const int *offsets, int columns, int rows) {
+    for (int y = 0; y < height; y++) {
+        const uint8_t *row = srcp + y * src_stride;
+        int64_t *tile_row = hist + (int64_t)y * rows / height * columns * 256;
+
+        for (int x = 0; x < width; x++)
+            tile_row[offsets[x] + row[x]]++;
+    }
+}
+
+
+// The panel, size px square, shows the luma histogram of every tile in the
+// same place as the tile, each one scaled to its highest bar. A bar covers
+// as many bins as it takes to fit the histogram in the cell, or a bin
+// covers several bars when the cell is wider than 256 px.
+static void drawTiles(uint8_t *dstp, int dst_stride, const int64_t *hist, int columns, int rows, int size) {
+    const int cell_width = size / columns;
+    const int cell_height = size / rows;
+    const int num_bars = cell_width - 2; // Inside the frame.
+
+    for (int tile = 0; tile < columns * rows; tile++) {
+        const int64_t *h = hist + tile * 256;
+        const int left = tile % columns * cell_width;
+        const int bottom = (tile / columns + 1) * cell_height - 2;
+        int64_t bars[512];
+        int64_t peak = 0;
+
+        for (int x = 0; x < num_bars; x++) {
+            const int first = x * 256 / num_bars;
+
+            bars[x] = 0;
+            for (int i = first; i < MAX(first + 1, (x + 1) * 256 / num_bars); i++)
+                bars[x] += h[i];
+            peak = MAX(peak, bars[x]);
+        }
+
+        if (!peak)
+            continue;
+
+        for (int x = 0; x < num_bars; x++) {
+            const int height = (int)((bars[x] * (cell_height - 2) + peak - 1) / peak);
+
+            for (int y = bottom - height + 1; y <= bottom; y++)
+                dstp[y * dst_stride + left + 1 + x] = 235;
+        }
+    }
+}
+
+
+static const VSFrame *VS_CC tilesGetFrame(int n, int activationReason, void *instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    TilesData *d = (TilesData *) instanceData;
+
+    if (activationReason == arInitial) {
+        vsapi->requestFrameFilter(n, d->node, frameCtx);
+    }
+    else if (activationReason == arAllFramesReady) {
+        const VSFrame *src = vsapi->getFrameFilter(n, d->node, frameCtx);
+
+        const VSVideoFormat *fi = &d->vi.format;
+        VSFrame *dst;
+
+        const int num_tiles = d->columns * d->rows;
+        int64_t *hist = (int64_t *)calloc((size_t)fi->numPlanes * num_tiles * 256, sizeof(int64_t));
+
+        if (!hist) {
+            vsapi->setFilterError("Tiles: failed to allocate the histograms", frameCtx);
+            vsapi->freeFrame(src);
+            return NULL;
+        }
+
+        if (d->show_panel) {
+            int height = MAX(d->size, vsapi->getFrameHeight(src, 0));
+            int width = vsapi->getFrameWidth(src, 0) + d->size;
+
+            dst = vsapi->newVideoFrame(fi, width, height, src, core);
+        }
+        else {
+            dst = vsapi->copyFrame(src, core);
+        }
+
+        VSMap *props = vsapi->getFramePropertiesRW(dst);
+        vsapi->mapSetInt(props, "tiles_columns", d->columns, maReplace);
+        vsapi->mapSetInt(props, "tiles_rows", d->rows, maReplace);
+
+        uint8_t *panelp[3];
+        int dst_stride[3];
+        int dst_height[3];
+
+        for (int plane = 0; plane < fi->numPlanes; plane++) {
+            const uint8_t *srcp = vsapi->getReadPtr(src, plane);
+            const int src_stride = vsapi->getStride(src, plane);
+            const int src_height = vsapi->getFrameHeight(src, plane);
+            const int src_width = vsapi->getFrameWidth(src, plane);
+
+            int64_t *plane_hist = hist + plane * num_tiles * 256;
+            countTiles(plane_hist, srcp, src_stride, src_width, src_height, d->offsets[plane], d->columns, d->rows);
+
+            char key[16];
+            snprintf(key, sizeof(key), "tiles_hist%d", plane);
+            vsapi->mapSetIntArray(props, key, plane_hist, num_tiles * 256);
+
+            if (!d->show_panel)
+                continue;
+
+            uint8_t *dstp = vsapi->getWritePtr(dst, plane);
+            dst_stride[plane] = vsapi->getStride(dst, plane);
+            dst_height[plane] = vsapi->getFrameHeight(dst, plane);
+            panelp[plane] = dstp + src_width;
+
+            // Copy src to dst one line at a time.
+            for (int y = 0; y < src_height; y++)
+                memcpy(dstp + dst_stride[plane] * y, srcp + src_stride * y, src_width);
+
+            // If src was less than the panel, make the extra lines black.
+            if (src_height < dst_height[plane]) {
+                memset(dstp + src_height * dst_stride[plane],
+                    (plane == 0) ? 16 : 128,
+                    (dst_height[plane] - src_height) * dst_stride[plane]);
+            }
+        }
+
+        if (d->show_panel) {
+            panelBlit(&d->panel, panelp, dst_stride, dst_height);
+            drawTiles(panelp[Y], dst_stride[Y], hist, d->columns, d->rows, d->size);
+        }
+
+        free(hist);
+
+        vsapi->freeFrame(src);
+
+        return dst;
+    }
+
+    return 0;
+}
+
+
+static void VS_CC tilesFree(void *instanceData, VSCore *core, const VSAPI *vsapi) {
+    TilesData *d = (TilesData *)instanceData;
+    vsapi->freeNode(d->node);
+    if (d->show_panel)
+        panelFree(&d->panel);
+    for (int plane = 0; plane < 3; plane++)
+        free(d->offsets[plane]);
+    free(d);
+}
+
+
+void VS_CC tilesCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
+    TilesData d;
+    TilesData *data;
+    int err;
+
+    d.node = vsapi->mapGetNode(in, "clip", 0, 0);
+    d.vi = *vsapi->getVideoInfo(d.node);
+
+    if (!vsh_isConstantVideoFormat(&d.vi) || d.vi.format.colorFamily == cfRGB || d.vi.format.sampleType != stInteger || d.vi.format.bitsPerSample != 8) {
+        vsapi->mapSetError(out, "Tiles: only constant format 8bit integer YUV or Gray input supported");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    d.columns = vsapi->mapGetIntSaturated(in, "columns", 0, &err);
+    if (err)
+        d.columns = 4;
+
+    d.rows = vsapi->mapGetIntSaturated(in, "rows", 0, &err);
+    if (err)
+        d.rows = 4;
+
+    d.show_panel = !!vsapi->mapGetInt(in, "panel", 0, &err);
+
+    d.size = vsapi->mapGetIntSaturated(in, "size", 0, &err);
+    if (err)
+        d.size = 256;
+
+    if (d.size != 128 && d.size != 256 && d.size != 512) {
+        vsapi->mapSetError(out, "Tiles: size must be 128, 256 or 512");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    // Every tile must have at least one pixel in every plane.
+    const int plane_width = d.vi.width >> d.vi.format.subSamplingW;
+    const int plane_height = d.vi.height >> d.vi.format.subSamplingH;
+
+    if (d.columns < 1 || d.rows < 1 || d.columns > plane_width || d.rows > plane_height) {
+        vsapi->mapSetError(out, "Tiles: columns and rows must be at least 1, and no more than the width and height of the smallest plane");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    if ((int64_t)d.columns * d.rows > TILES_MAX) {
+        vsapi->mapSetError(out, "Tiles: there can't be more than 4096 tiles");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    // At least 4 px per cell, for the frame and two bars.
+    if (d.show_panel && (d.columns > d.size / 4 || d.rows > d.size / 4)) {
+        vsapi->mapSetError(out, "Tiles: the panel can't show more than size / 4 columns or rows");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    memset(d.offsets, 0, sizeof(d.offsets));
+    for (int plane = 0; plane < d.vi.format.numPlanes; plane++) {
+        const int width = plane ? plane_width : d.vi.width;
+
+        d.offsets[plane] = (int *)malloc(width * sizeof(int));
+        for (int x = 0; x < width; x++)
+            d.offsets[plane][x] = (int)((int64_t)x * d.columns / width) * 256;
+    }
+
+    if (d.show_panel) {
+        // A grey frame around every cell.
+        const uint8_t fill[3] = { 16, 128, 128 };
+        const int cell_width = d.size / d.columns;
+        const int cell_height = d.size / d.rows;
+
+        panelInit(&d.panel, &d.vi.format, d.size, d.size, fill);
+
+        for (int y = 0; y < cell_height * d.rows; y++) {
+            for (int x = 0; x < cell_width * d.columns; x++) {
+                if (x % cell_width == 0 || x % cell_width == cell_width - 1 || y % cell_height == cell_height - 1)
+                    d.panel.data[Y][y * d.panel.width[Y] + x] = 64;
+            }
+        }
+
+        d.vi.width += d.size;
+        d.vi.height = MAX(d.size, d.vi.height);
+    }
+
+    data = (TilesData *)malloc(sizeof(d));
+    *data = d;
+
+    VSFilterDependency deps[] = { {d.node, rpStrictSpatial} };
+    vsapi->createVideoFilter(out, "Tiles", &d.vi, tilesGetFrame, tilesFree, fmParallel, deps, 1, data, core);
+}
@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <VapourSynth4.h>
+#include "VSHelper4.h"
+
+#include "common.h"
+#include "count.h"
+#include "panel.h"
+
+typedef struct {
+    VSNode *node;
+    VSVideoInfo vi;
+    double factor;
+    int length;
+    CountPlaneFunc count;
+    Panel panel;
+
+    // The columns of the last frames counted, frame n in slot n % length.
+    // Frames that aren't there (never rendered, or pushed out by others)
+    // are requested and counted again, so the strip doesn't depend on the
+    // order the frames are rendered in.
+    pthread_mutex_t lock;
+    int *frames;
+    uint8_t *columns;
+} TimelineData;
+
+
+// Frame n's strip, from the columns found in the ring when it was
+// requested, and those of the frames that had to be requested.
+typedef struct {
+    uint8_t *columns;
+    uint8_t *cached;
+} TimelineWindow;
+
+
+// Turns a frame's luma histogram into a column, bright where there are
+// many pixels. Counts above the clamp value are drawn as if they were the
+// clamp value, like in Levels.
+static void makeColumn(uint8_t column[256], const int hist[256], int clampval) {
+    int maxval = 1;
+
+    for (int i = 0; i < 256; i++)
+        maxval = MAX(maxval, MIN(hist[i], clampval));
+
+    for (int i = 0; i < 256; i++) {
+        // The highest values at the top.
+        column[255 - i] = hist[i] ? 16 + (int)((int64_t)MIN(hist[i], maxval) * 219 / maxval) : 0;
+    }
+}
+
+
+static const VSFrame *VS_CC timelineGetFrame(int n, int activationReason, void *instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    TimelineData *d = (TimelineData *) instanceData;
+
+    // The current frame goes in the rightmost column.
+    const int first = n - (d->length - 1);
+
+    if (activationReason == arInitial) {
+        TimelineWindow *w = (TimelineWindow *)malloc(sizeof(TimelineWindow));
+        w->columns = (uint8_t *)malloc(d->length * 256);
+        w->cached = (uint8_t *)calloc(d->length, 1);
+        *frameData = w;
+
+        // Copied now, as the ring can change before the frames are ready.
+        pthread_mutex_lock(&d->lock);
+
+        for (int x = 0; x < d->length - 1; x++) {
+            const int frame = first + x;
+            if (frame < 0)
+                continue;
+
+            const int s = frame % d->length;
+            if (d->frames[s] == frame) {
+                memcpy(w->columns + x * 256, d->columns + s * 256, 256);
+                w->cached[x] = 1;
+            }
+        }
+
+        pthread_mutex_unlock(&d->lock);
+
+        for (int x = 0; x < d->length - 1; x++) {
+            if (first + x >= 0 && !w->cached[x])
+                vsapi->requestFrameFilter(first + x, d->node, frameCtx);
+        }
+
+        vsapi->requestFrameFilter(n, d->node, frameCtx);
+    }
+    else if (activationReason == arError) {
+        TimelineWindow *w = (TimelineWindow *)*frameData;
+        if (w) {
+            free(w->columns);
+            free(w->cached);
+            free(w);
+        }
+    }
+    else if (activationReason == arAllFramesReady) {
+        TimelineWindow *w = (TimelineWindow *)*frameData;
+
+        const VSFrame *src = vsapi->getFrameFilter(n, d->node, frameCtx);
+
+        const VSVideoFormat *fi = &d->vi.format;
+        int height = MAX(256, vsapi->getFrameHeight(src, 0));
+        int width = vsapi->getFrameWidth(src, 0) + d->length;
+
+        VSFrame *dst = vsapi->newVideoFrame(fi, width, height, src, core);
+
+        uint8_t *dstp[3];
+        int dst_stride[3];
+
+        int src_height[3];
+        int src_width[3];
+
+        int dst_height[3];
+
+        uint8_t *panelp[3];
+
+        int y;
+
+        int plane;
+
+        for (plane = 0; plane < fi->numPlanes; plane++) {
+            const uint8_t *srcp = vsapi->getReadPtr(src, plane);
+            const int src_stride = vsapi->getStride(src, plane);
+
+            dstp[plane] = vsapi->getWritePtr(dst, plane);
+            dst_stride[plane] = vsapi->getStride(dst, plane);
+
+            src_height[plane] = vsapi->getFrameHeight(src, plane);
+            src_width[plane] = vsapi->getFrameWidth(src, plane);
+
+            dst_height[plane] = vsapi->getFrameHeight(dst, plane);
+
+            panelp[plane] = dstp[plane] + src_width[plane];
+
+            // Copy src to dst one line at a time.
+            for (y = 0; y < src_height[plane]; y++) {
+                memcpy(dstp[plane] + dst_stride[plane] * y,
+                    srcp + src_stride * y,
+                    src_width[plane]);
+            }
+
+            // If src was less than 256 px tall, make the extra lines black.
+            if (src_height[plane] < dst_height[plane]) {
+                memset(dstp[plane] + src_height[plane] * dst_stride[plane],
+                    (plane == 0) ? 16 : 128,
+                    (dst_height[plane] - src_height[plane]) * dst_stride[plane]);
+            }
+        }
+
+        // The current frame is always counted, the others only if they
+        // weren't in the ring.
+        for (int x = 0; x < d->length; x++) {
+            const int frame = first + x;
+            if (frame < 0 || w->cached[x])
+                continue;
+
+            const VSFrame *f = (frame == n) ? src : vsapi->getFrameFilter(frame, d->node, frameCtx);
+            const int f_width = vsapi->getFrameWidth(f, 0);
+            const int f_height = vsapi->getFrameHeight(f, 0);
+            int hist[256] = { 0 };
+
+            d->count(hist, vsapi->getReadPtr(f, 0), vsapi->getStride(f, 0), f_width, f_height, NULL, 0, 0, 0, NULL);
+            makeColumn(w->columns + x * 256, hist, (int)((f_width * f_height) * d->factor / 100.0));
+
+            if (f != src)
+                vsapi->freeFrame(f);
+
+            pthread_mutex_lock(&d->lock);
+
+            const int s = frame % d->length;
+            d->frames[s] = frame;
+            memcpy(d->columns + s * 256, w->columns + x * 256, 256);
+
+            pthread_mutex_unlock(&d->lock);
+        }
+
+        panelBlit(&d->panel, panelp, dst_stride, dst_height);
+
+        for (int x = 0; x < d->length; x++) {
+            if (first + x < 0)
+                continue;
+
+            const uint8_t *c = w->columns + x * 256;
+            for (y = 0; y < 256; y++)
+                panelp[Y][y * dst_stride[Y] + x] = c[y];
+        }
+
+        free(w->columns);
+        free(w->cached);
+        free(w);
+
+        vsapi->freeFrame(src);
+
+        return dst;
+    }
+
+    return 0;
+}
+
+
+static void VS_CC timelineFree(void *instanceData, VSCore *core, const VSAPI *vsapi) {
+    TimelineData *d = (TimelineData *)instanceData;
+    vsapi->freeNode(d->node);
+    panelFree(&d->panel);
+    pthread_mutex_destroy(&d->lock);
+    free(d->frames);
+    free(d->columns);
+    free(d);
+}
+
+
+void VS_CC timelineCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
+    TimelineData d;
+    TimelineData *data;
+    int err;
+
+    d.node = vsapi->mapGetNode(in, "clip", 0, 0);
+    d.vi = *vsapi->getVideoInfo(d.node);
+
+    if (!vsh_isConstantVideoFormat(&d.vi) || d.vi.format.colorFamily == cfRGB || d.vi.format.sampleType != stInteger || d.vi.format.bitsPerSample != 8) {
+        vsapi->mapSetError(out, "Timeline: only constant format 8bit integer YUV or Gray input supported");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    d.length = vsapi->mapGetIntSaturated(in, "length", 0, &err);
+    if (err)
+        d.length = 256;
+
+    if (d.length < 1 || d.length % (1 << d.vi.format.subSamplingW)) {
+        vsapi->mapSetError(out, "Timeline: length must be positive and a multiple of the horizontal chroma subsampling");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    d.factor = vsapi->mapGetFloat(in, "factor", 0, &err);
+    if (err)
+        d.factor = 100.0;
+
+    if (d.factor < 0.0 || d.factor > 100.0) {
+        vsapi->mapSetError(out, "Timeline: factor must be between 0 and 100 (inclusive)");
+        vsapi->freeNode(d.node);
+        return;
+    }
+
+    d.count = selectCountPlane(0, 0, 0);
+
+    const uint8_t fill[3] = { 0, 128, 128 };
+    panelInit(&d.panel, &d.vi.format, d.length, 256, fill);
+
+    if (d.vi.width)
+        d.vi.width += d.length;
+    if (d.vi.height)
+        d.vi.height = MAX(256, d.vi.height);
+
+    data = (TimelineData *)malloc(sizeof(d));
+    *data = d;
+
+    pthread_mutex_init(&data->lock, NULL);
+    data->frames = (int *)malloc(d.length * sizeof(int));
+    for (int i = 0; i < d.length; i++)
+        data->frames[i] = -1;
+    data->columns = (uint8_t *)malloc(d.length * 256);
+
+    VSFilterDependency deps[] = { {d.node, rpStrictSpatial} };
+    vsapi->createVideoFilter(out, "Timeline", &d.vi, timelineGetFrame, timelineFree, fmParallel, deps, 1, data, core);
+}